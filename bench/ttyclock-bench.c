@@ -0,0 +1,1153 @@
+/*
+ *      TTY-CLOCK end-to-end benchmark.
+ *      Copyright © 2009-2018 tty-clock contributors
+ *      All rights reserved.
+ *
+ *      Redistribution and use in source and binary forms, with or without
+ *      modification, are permitted provided that the following conditions are
+ *      met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following disclaimer
+ *        in the documentation and/or other materials provided with the
+ *        distribution.
+ *      * Neither the name of the  nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ *      THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *      "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *      LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *      A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *      OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *      SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *      LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *      DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *      THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *      (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *      OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the real tty-clock binary under a pseudo-terminal, feeds its output
+ * to a small xterm emulator and reads the clock back from the emulated
+ * screen. Every figure is compared with the limit stored in a baseline
+ * file, the exit status is 1 when one of them is over its limit.
+ *
+ * usage : ttyclock-bench [-wv] [-b baseline] [-t seconds] [-n runs] tty-clock
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <pty.h>
+#elif defined(__APPLE__)
+#include <util.h>
+#else
+#include <libutil.h>
+#endif
+
+#define NORMFRAMEW 35      /* as in ttyclock.h */
+#define ROWS      24
+#define COLS      80
+#define MAXROWS   64
+#define MAXCOLS   256
+#define TIMEOUT   3000.0  /* ms to wait for a screen change */
+#define MAXFRAMES 1024    /* longest bytes per frame run, in seconds */
+#define HEADROOM  2       /* limit = measured * HEADROOM + slack with -w */
+
+typedef enum { False, True } Bool;
+
+/* Digit slots of the clock face, left to right */
+typedef enum
+{
+     SlotHour0, SlotHour1,
+     SlotMinute0, SlotMinute1,
+     SlotSecond0, SlotSecond1,
+     SlotLast
+} Slot;
+
+/* The number matrix of ttyclock.h, what the face is read back against */
+static const Bool number[][15] =
+{
+     {1,1,1,1,0,1,1,0,1,1,0,1,1,1,1}, /* 0 */
+     {0,0,1,0,0,1,0,0,1,0,0,1,0,0,1}, /* 1 */
+     {1,1,1,0,0,1,1,1,1,1,0,0,1,1,1}, /* 2 */
+     {1,1,1,0,0,1,1,1,1,0,0,1,1,1,1}, /* 3 */
+     {1,0,1,1,0,1,1,1,1,0,0,1,0,0,1}, /* 4 */
+     {1,1,1,1,0,0,1,1,1,0,0,1,1,1,1}, /* 5 */
+     {1,1,1,1,0,0,1,1,1,1,0,1,1,1,1}, /* 6 */
+     {1,1,1,0,0,1,0,0,1,0,0,1,0,0,1}, /* 7 */
+     {1,1,1,1,0,1,1,1,1,1,0,1,1,1,1}, /* 8 */
+     {1,1,1,1,0,1,1,1,1,0,0,1,1,1,1}, /* 9 */
+};
+
+/* Emulated terminal */
+typedef struct
+{
+     char ch;
+     Bool acs;
+     short bg;
+} cell_t;
+
+typedef enum { Ground, Escape, Csi, Osc, Charset } vtstate_t;
+
+typedef struct
+{
+     int rows, cols;
+     cell_t cell[MAXROWS][MAXCOLS];
+     int r, c, sr, sc;
+     int top, bot;
+     Bool wrap;
+     short bg;
+     char g[2];
+     int gl;
+     char last;
+     vtstate_t state;
+     char param[64];
+     int plen;
+     int charset;
+} vt_t;
+
+/* What was read back from the screen */
+typedef struct
+{
+     Bool found;
+     int row, col;
+     int ndigit;
+     int digit[SlotLast];
+     Bool boxed;
+} face_t;
+
+/* A child tty-clock */
+typedef struct
+{
+     pid_t pid;
+     int fd;
+     uint64_t bytes;
+     vt_t vt;
+} child_t;
+
+typedef struct
+{
+     const char *name;
+     const char *unit;
+     double slack;
+     double value;
+} result_t;
+
+/* Timings get some slack for the scheduler of a busy host */
+static result_t result[] =
+{
+     { "first_frame_ms",  "ms",    20, -1 },
+     { "bytes_per_frame", "bytes",  0, -1 },
+     { "key_hjkl_ms",     "ms",    20, -1 },
+     { "key_s_ms",        "ms",    20, -1 },
+     { "key_c_ms",        "ms",    20, -1 },
+     { "key_x_ms",        "ms",    20, -1 },
+     { "resize_ms",       "ms",    20, -1 },
+};
+#define NRESULT (sizeof(result) / sizeof(result[0]))
+
+static const char *binary;
+static int runs = 5;
+static int seconds = 10;
+static Bool verbose = False;
+
+double
+now_ms(void)
+{
+     struct timespec ts;
+
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+
+     return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int
+cmp_double(const void *a, const void *b)
+{
+     double x = *(const double *)a, y = *(const double *)b;
+
+     return (x > y) - (x < y);
+}
+
+/* Median of n samples, -1 if one of them timed out */
+double
+median(double *v, int n)
+{
+     int i;
+
+     for(i = 0; i < n; ++i)
+          if(v[i] < 0)
+               return -1;
+
+     qsort(v, n, sizeof(double), cmp_double);
+
+     return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/*
+ * Terminal emulator, just enough of xterm for what ncurses sends
+ */
+
+void
+vt_erase(vt_t *vt, int r, int c0, int c1)
+{
+     int c;
+
+     for(c = c0; c < c1 && c < vt->cols; ++c)
+     {
+          vt->cell[r][c].ch = ' ';
+          vt->cell[r][c].acs = False;
+          vt->cell[r][c].bg = vt->bg;
+     }
+}
+
+/* Like xterm, keep the content and blank what a larger size uncovers */
+void
+vt_resize(vt_t *vt, int rows, int cols)
+{
+     short bg = vt->bg;
+     int r, c;
+
+     vt->bg = -1;
+     vt->rows = MAXROWS;
+     vt->cols = MAXCOLS;
+     for(r = 0; r < MAXROWS; ++r)
+          for(c = 0; c < MAXCOLS; ++c)
+               if(r >= rows || c >= cols)
+                    vt_erase(vt, r, c, c + 1);
+
+     vt->bg = bg;
+     vt->rows = rows;
+     vt->cols = cols;
+     vt->top = 0;
+     vt->bot = rows - 1;
+     if(vt->r >= rows)
+          vt->r = rows - 1;
+     if(vt->c >= cols)
+          vt->c = cols - 1;
+}
+
+void
+vt_reset(vt_t *vt, int rows, int cols)
+{
+     memset(vt, 0, sizeof(vt_t));
+     vt->bg = -1;
+     vt->g[0] = vt->g[1] = 'B';
+
+     vt_resize(vt, 0, 0);
+     vt_resize(vt, rows, cols);
+}
+
+/* Scroll rows top..bot up by n (down if n < 0) */
+void
+vt_scroll(vt_t *vt, int top, int bot, int n)
+{
+     int r;
+
+     if(top > bot)
+          return;
+
+     for(; n > 0; --n)
+     {
+          for(r = top; r < bot; ++r)
+               memcpy(vt->cell[r], vt->cell[r + 1], sizeof(vt->cell[r]));
+          vt_erase(vt, bot, 0, vt->cols);
+     }
+     for(; n < 0; ++n)
+     {
+          for(r = bot; r > top; --r)
+               memcpy(vt->cell[r], vt->cell[r - 1], sizeof(vt->cell[r]));
+          vt_erase(vt, top, 0, vt->cols);
+     }
+}
+
+void
+vt_linefeed(vt_t *vt)
+{
+     if(vt->r == vt->bot)
+          vt_scroll(vt, vt->top, vt->bot, 1);
+     else if(vt->r < vt->rows - 1)
+          ++vt->r;
+}
+
+void
+vt_print(vt_t *vt, char ch)
+{
+     if(vt->wrap)
+     {
+          vt->c = 0;
+          vt_linefeed(vt);
+          vt->wrap = False;
+     }
+
+     vt->cell[vt->r][vt->c].ch = ch;
+     vt->cell[vt->r][vt->c].acs = (vt->g[vt->gl] == '0');
+     vt->cell[vt->r][vt->c].bg = vt->bg;
+     vt->last = ch;
+
+     if(vt->c == vt->cols - 1)
+          vt->wrap = True;
+     else
+          ++vt->c;
+}
+
+void
+vt_sgr(vt_t *vt, int *p, int n)
+{
+     int i;
+
+     for(i = 0; i < n; ++i)
+     {
+          if(p[i] == 0 || p[i] == 49)
+               vt->bg = -1;
+          else if(p[i] >= 40 && p[i] <= 47)
+               vt->bg = p[i] - 40;
+          else if(p[i] >= 100 && p[i] <= 107)
+               vt->bg = p[i] - 100 + 8;
+          else if((p[i] == 38 || p[i] == 48) && i + 1 < n)
+          {
+               if(p[i] == 48 && p[i + 1] == 5 && i + 2 < n)
+                    vt->bg = p[i + 2];
+               else if(p[i] == 48 && p[i + 1] == 2)
+                    vt->bg = 256;
+               i += (p[i + 1] == 5) ? 2 : 4;
+          }
+     }
+}
+
+void
+vt_csi(vt_t *vt, char final)
+{
+     int p[16] = { 0 }, n = 0, i, c;
+     char *s = vt->param;
+     Bool private = False;
+
+     if(*s == '?' || *s == '>' || *s == '=')
+     {
+          private = True;
+          ++s;
+     }
+     for(; *s && n < 16; ++s)
+     {
+          if(*s == ';')
+               ++n;
+          else if(*s >= '0' && *s <= '9')
+               p[n] = p[n] * 10 + (*s - '0');
+     }
+     if(vt->plen)
+          ++n;
+
+#define P(i, d) ((p[i]) ? p[i] : (d))
+#define CLAMP(v, lo, hi) (((v) < (lo)) ? (lo) : ((v) > (hi)) ? (hi) : (v))
+
+     if(private && final != 'J' && final != 'K')
+          return;
+
+     if(final != 'b')
+          vt->wrap = False;
+
+     switch(final)
+     {
+     case 'H':
+     case 'f':
+          vt->r = CLAMP(P(0, 1) - 1, 0, vt->rows - 1);
+          vt->c = CLAMP(P(1, 1) - 1, 0, vt->cols - 1);
+          break;
+     case 'A':
+          vt->r = CLAMP(vt->r - P(0, 1), 0, vt->rows - 1);
+          break;
+     case 'B':
+          vt->r = CLAMP(vt->r + P(0, 1), 0, vt->rows - 1);
+          break;
+     case 'C':
+          vt->c = CLAMP(vt->c + P(0, 1), 0, vt->cols - 1);
+          break;
+     case 'D':
+          vt->c = CLAMP(vt->c - P(0, 1), 0, vt->cols - 1);
+          break;
+     case 'E':
+          vt->r = CLAMP(vt->r + P(0, 1), 0, vt->rows - 1);
+          vt->c = 0;
+          break;
+     case 'F':
+          vt->r = CLAMP(vt->r - P(0, 1), 0, vt->rows - 1);
+          vt->c = 0;
+          break;
+     case 'G':
+     case '`':
+          vt->c = CLAMP(P(0, 1) - 1, 0, vt->cols - 1);
+          break;
+     case 'd':
+          vt->r = CLAMP(P(0, 1) - 1, 0, vt->rows - 1);
+          break;
+     case 'J':
+          if(p[0] == 0)
+          {
+               vt_erase(vt, vt->r, vt->c, vt->cols);
+               for(i = vt->r + 1; i < vt->rows; ++i)
+                    vt_erase(vt, i, 0, vt->cols);
+          }
+          else if(p[0] == 1)
+          {
+               for(i = 0; i < vt->r; ++i)
+                    vt_erase(vt, i, 0, vt->cols);
+               vt_erase(vt, vt->r, 0, vt->c + 1);
+          }
+          else
+               for(i = 0; i < vt->rows; ++i)
+                    vt_erase(vt, i, 0, vt->cols);
+          break;
+     case 'K':
+          if(p[0] == 0)
+               vt_erase(vt, vt->r, vt->c, vt->cols);
+          else if(p[0] == 1)
+               vt_erase(vt, vt->r, 0, vt->c + 1);
+          else
+               vt_erase(vt, vt->r, 0, vt->cols);
+          break;
+     case 'X':
+          vt_erase(vt, vt->r, vt->c, vt->c + P(0, 1));
+          break;
+     case '@':
+          c = CLAMP(P(0, 1), 0, vt->cols - vt->c);
+          memmove(&vt->cell[vt->r][vt->c + c], &vt->cell[vt->r][vt->c],
+                  (vt->cols - vt->c - c) * sizeof(cell_t));
+          vt_erase(vt, vt->r, vt->c, vt->c + c);
+          break;
+     case 'P':
+          c = CLAMP(P(0, 1), 0, vt->cols - vt->c);
+          memmove(&vt->cell[vt->r][vt->c], &vt->cell[vt->r][vt->c + c],
+                  (vt->cols - vt->c - c) * sizeof(cell_t));
+          vt_erase(vt, vt->r, vt->cols - c, vt->cols);
+          break;
+     case 'L':
+          vt_scroll(vt, vt->r, vt->bot, -P(0, 1));
+          break;
+     case 'M':
+          vt_scroll(vt, vt->r, vt->bot, P(0, 1));
+          break;
+     case 'S':
+          vt_scroll(vt, vt->top, vt->bot, P(0, 1));
+          break;
+     case 'T':
+          vt_scroll(vt, vt->top, vt->bot, -P(0, 1));
+          break;
+     case 'b':
+          for(i = 0; i < P(0, 1); ++i)
+               vt_print(vt, vt->last);
+          break;
+     case 'r':
+          vt->top = CLAMP(P(0, 1) - 1, 0, vt->rows - 1);
+          vt->bot = CLAMP(P(1, vt->rows) - 1, vt->top, vt->rows - 1);
+          vt->r = vt->c = 0;
+          break;
+     case 'm':
+          vt_sgr(vt, p, (n) ? n : 1);
+          break;
+     }
+
+#undef P
+#undef CLAMP
+}
+
+void
+vt_feed(vt_t *vt, const char *buf, ssize_t len)
+{
+     ssize_t i;
+     char ch;
+
+     for(i = 0; i < len; ++i)
+     {
+          ch = buf[i];
+
+          switch(vt->state)
+          {
+          case Escape:
+               vt->state = Ground;
+               switch(ch)
+               {
+               case '[':
+                    vt->state = Csi;
+                    vt->plen = 0;
+                    vt->param[0] = '\0';
+                    break;
+               case ']':
+                    vt->state = Osc;
+                    break;
+               case '(':
+               case ')':
+                    vt->state = Charset;
+                    vt->charset = (ch == ')');
+                    break;
+               case '7':
+                    vt->sr = vt->r;
+                    vt->sc = vt->c;
+                    break;
+               case '8':
+                    vt->r = vt->sr;
+                    vt->c = vt->sc;
+                    break;
+               case 'D':
+                    vt_linefeed(vt);
+                    break;
+               case 'E':
+                    vt->c = 0;
+                    vt_linefeed(vt);
+                    break;
+               case 'M':
+                    if(vt->r == vt->top)
+                         vt_scroll(vt, vt->top, vt->bot, -1);
+                    else if(vt->r > 0)
+                         --vt->r;
+                    break;
+               case 'c':
+                    vt_reset(vt, vt->rows, vt->cols);
+                    break;
+               }
+               break;
+
+          case Csi:
+               if(ch >= 0x40 && ch <= 0x7e)
+               {
+                    vt->state = Ground;
+                    vt_csi(vt, ch);
+               }
+               else if(ch >= 0x30 && ch <= 0x3f && vt->plen < (int)sizeof(vt->param) - 1)
+               {
+                    vt->param[vt->plen++] = ch;
+                    vt->param[vt->plen] = '\0';
+               }
+               break;
+
+          case Osc:
+               if(ch == '\007' || ch == '\\')
+                    vt->state = Ground;
+               break;
+
+          case Charset:
+               vt->g[vt->charset] = ch;
+               vt->state = Ground;
+               break;
+
+          case Ground:
+               switch(ch)
+               {
+               case '\033':
+                    vt->state = Escape;
+                    break;
+               case '\r':
+                    vt->c = 0;
+                    vt->wrap = False;
+                    break;
+               case '\n':
+               case '\v':
+               case '\f':
+                    vt_linefeed(vt);
+                    vt->wrap = False;
+                    break;
+               case '\b':
+                    if(vt->c > 0)
+                         --vt->c;
+                    vt->wrap = False;
+                    break;
+               case '\t':
+                    vt->c = ((vt->c / 8) + 1) * 8;
+                    if(vt->c >= vt->cols)
+                         vt->c = vt->cols - 1;
+                    break;
+               case '\016':
+                    vt->gl = 1;
+                    break;
+               case '\017':
+                    vt->gl = 0;
+                    break;
+               default:
+                    if((unsigned char)ch >= ' ')
+                         vt_print(vt, ch);
+                    break;
+               }
+               break;
+          }
+     }
+}
+
+/* Print the emulated screen, lit cells as '#' */
+void
+vt_dump(vt_t *vt)
+{
+     int r, c;
+
+     for(r = 0; r < vt->rows; ++r)
+     {
+          for(c = 0; c < vt->cols; ++c)
+               fputc((vt->cell[r][c].bg != -1) ? '#' : vt->cell[r][c].ch, stderr);
+          fputc('\n', stderr);
+     }
+}
+
+/*
+ * Reading the clock back from the screen
+ */
+
+Bool
+lit(vt_t *vt, int r, int c)
+{
+     if(r < 0 || c < 0 || r >= vt->rows || c >= vt->cols)
+          return False;
+
+     return vt->cell[r][c].bg != -1;
+}
+
+/* Digit drawn at r, c or -1 */
+int
+read_digit(vt_t *vt, int r, int c)
+{
+     int n, i, a, b;
+     Bool cell[15];
+
+     for(i = 0; i < 15; ++i)
+     {
+          a = lit(vt, r + i / 3, c + (i % 3) * 2);
+          b = lit(vt, r + i / 3, c + (i % 3) * 2 + 1);
+          if(a != b)
+               return -1;
+          cell[i] = a;
+     }
+
+     for(n = 0; n < 10; ++n)
+          if(!memcmp(cell, number[n], sizeof(cell)))
+               return n;
+
+     return -1;
+}
+
+/* Colon whose left cell is at row r, column c of a digit row */
+Bool
+read_colon(vt_t *vt, int r, int c)
+{
+     return lit(vt, r + 1, c) && lit(vt, r + 1, c + 1)
+          && lit(vt, r + 3, c) && lit(vt, r + 3, c + 1)
+          && !lit(vt, r, c) && !lit(vt, r + 2, c) && !lit(vt, r + 4, c);
+}
+
+/* Same offsets as draw_clock(), relative to the first digit */
+static const int slotcol[SlotLast] = { 0, 7, 19, 26, 38, 45 };
+
+face_t
+read_face(vt_t *vt)
+{
+     face_t f;
+     int r, c, s;
+
+     memset(&f, 0, sizeof(f));
+
+     for(r = 0; r + 5 <= vt->rows && !f.found; ++r)
+          for(c = 0; c + 32 <= vt->cols && !f.found; ++c)
+          {
+               if(!read_colon(vt, r, c + 15))
+                    continue;
+
+               for(s = SlotHour0; s <= SlotMinute1; ++s)
+                    if((f.digit[s] = read_digit(vt, r, c + slotcol[s])) < 0)
+                         break;
+               if(s <= SlotMinute1)
+                    continue;
+
+               f.found = True;
+               f.row = r;
+               f.col = c;
+               f.ndigit = 4;
+
+               if(read_colon(vt, r, c + NORMFRAMEW - 1)
+                  && (f.digit[SlotSecond0] = read_digit(vt, r, c + slotcol[SlotSecond0])) >= 0
+                  && (f.digit[SlotSecond1] = read_digit(vt, r, c + slotcol[SlotSecond1])) >= 0)
+                    f.ndigit = 6;
+
+               /* Upper left corner of box() */
+               if(r > 0 && c > 0)
+                    f.boxed = vt->cell[r - 1][c - 1].ch != ' ';
+          }
+
+     return f;
+}
+
+/*
+ * Driving the child
+ */
+
+Bool
+spawn(child_t *ch, char *const argv[], int rows, int cols)
+{
+     struct winsize ws = { rows, cols, 0, 0 };
+
+     memset(ch, 0, sizeof(child_t));
+     vt_reset(&ch->vt, rows, cols);
+
+     if((ch->pid = forkpty(&ch->fd, NULL, NULL, &ws)) < 0)
+     {
+          fprintf(stderr, "ttyclock-bench: error: forkpty: %s.\n", strerror(errno));
+          return False;
+     }
+
+     if(!ch->pid)
+     {
+          setenv("TERM", "xterm-256color", 1);
+          setenv("LC_ALL", "C", 1);
+          execv(binary, argv);
+          fprintf(stderr, "ttyclock-bench: error: couldn't run '%s': %s.\n",
+                  binary, strerror(errno));
+          _exit(127);
+     }
+
+     fcntl(ch->fd, F_SETFL, fcntl(ch->fd, F_GETFL) | O_NONBLOCK);
+
+     return True;
+}
+
+void
+reap(child_t *ch)
+{
+     kill(ch->pid, SIGTERM);
+     waitpid(ch->pid, NULL, 0);
+     close(ch->fd);
+}
+
+/* Read what the child wrote within timeout ms, False when it is gone */
+Bool
+pump(child_t *ch, double timeout)
+{
+     char buf[4096];
+     struct pollfd pfd = { ch->fd, POLLIN, 0 };
+     ssize_t len;
+
+     if(poll(&pfd, 1, (int)timeout) <= 0)
+          return True;
+
+     while((len = read(ch->fd, buf, sizeof(buf))) > 0)
+     {
+          ch->bytes += len;
+          vt_feed(&ch->vt, buf, len);
+     }
+
+     return !(len == 0 || (len < 0 && errno != EAGAIN));
+}
+
+/* Wait until the face read back satisfies cond, return the time taken
+ * since start or -1 */
+double
+wait_face(child_t *ch, double start, Bool (*cond)(face_t *, face_t *), face_t *ref, face_t *out)
+{
+     face_t f;
+
+     for(;;)
+     {
+          f = read_face(&ch->vt);
+          if(cond(&f, ref))
+          {
+               if(out)
+                    *out = f;
+               return now_ms() - start;
+          }
+          if(now_ms() - start > TIMEOUT || !pump(ch, 10))
+          {
+               if(verbose)
+                    vt_dump(&ch->vt);
+               return -1;
+          }
+     }
+}
+
+Bool
+is_found(face_t *f, face_t *ref)
+{
+     return f->found;
+}
+
+Bool
+has_moved(face_t *f, face_t *ref)
+{
+     return f->found && (f->row != ref->row || f->col != ref->col);
+}
+
+Bool
+at_position(face_t *f, face_t *ref)
+{
+     return f->found && f->row == ref->row && f->col == ref->col;
+}
+
+Bool
+ndigit_changed(face_t *f, face_t *ref)
+{
+     return f->found && f->ndigit != ref->ndigit;
+}
+
+Bool
+box_changed(face_t *f, face_t *ref)
+{
+     return f->found && f->boxed != ref->boxed;
+}
+
+Bool
+second_changed(face_t *f, face_t *ref)
+{
+     return f->found && f->ndigit == 6
+          && memcmp(f->digit, ref->digit, sizeof(f->digit));
+}
+
+/* Send key and return how long the screen took to satisfy cond */
+double
+key_latency(child_t *ch, char key, Bool (*cond)(face_t *, face_t *), face_t *ref, face_t *out)
+{
+     double start = now_ms();
+
+     if(write(ch->fd, &key, 1) != 1)
+          return -1;
+
+     return wait_face(ch, start, cond, ref, out);
+}
+
+/*
+ * Benchmarks
+ */
+
+void
+bench_first_frame(void)
+{
+     char *argv[] = { "tty-clock", NULL };
+     double v[runs];
+     child_t ch;
+     face_t f;
+     struct tm *tm;
+     time_t t;
+     int i;
+
+     for(i = 0; i < runs; ++i)
+     {
+          double start = now_ms();
+
+          v[i] = -1;
+          if(!spawn(&ch, argv, ROWS, COLS))
+               continue;
+          v[i] = wait_face(&ch, start, is_found, NULL, &f);
+
+          /* The first frame has to show the right time too */
+          t = time(NULL);
+          tm = localtime(&t);
+          if(v[i] >= 0 && f.digit[SlotMinute1] != tm->tm_min % 10
+             && f.digit[SlotMinute1] != (tm->tm_min + 9) % 10)
+          {
+               fprintf(stderr, "ttyclock-bench: first frame shows %d%d:%d%d.\n",
+                       f.digit[0], f.digit[1], f.digit[2], f.digit[3]);
+               v[i] = -1;
+          }
+
+          reap(&ch);
+     }
+
+     result[0].value = median(v, runs);
+}
+
+void
+bench_bytes_per_frame(void)
+{
+     char *argv[] = { "tty-clock", "-s", NULL };
+     double v[MAXFRAMES];
+     child_t ch;
+     face_t f, prev;
+     uint64_t bytes;
+     double start;
+     int frames = 0;
+
+     if(!spawn(&ch, argv, ROWS, COLS))
+          return;
+
+     start = now_ms();
+     if(wait_face(&ch, start, is_found, NULL, &prev) < 0)
+     {
+          reap(&ch);
+          return;
+     }
+
+     /* Count from the first second change, the first frame is a full draw */
+     if(wait_face(&ch, now_ms(), second_changed, &prev, &prev) < 0)
+     {
+          reap(&ch);
+          return;
+     }
+     bytes = ch.bytes;
+     start = now_ms();
+
+     /* Median, so that the odd minute change doesn't count */
+     while(now_ms() - start < seconds * 1000.0 && frames < MAXFRAMES)
+     {
+          if(!pump(&ch, 10))
+               break;
+          f = read_face(&ch.vt);
+          if(second_changed(&f, &prev))
+          {
+               prev = f;
+               v[frames++] = ch.bytes - bytes;
+               bytes = ch.bytes;
+          }
+     }
+
+     if(frames)
+          result[1].value = median(v, frames);
+
+     reap(&ch);
+}
+
+void
+bench_keys(void)
+{
+     char *argv[] = { "tty-clock", NULL };
+     const char *moves = "ljhk";
+     double hjkl[runs * 4], s[runs], c[runs], x[runs];
+     child_t ch;
+     face_t f, home;
+     int i, k;
+
+     if(!spawn(&ch, argv, ROWS, COLS))
+          return;
+
+     if(wait_face(&ch, now_ms(), is_found, NULL, &home) < 0)
+     {
+          reap(&ch);
+          return;
+     }
+
+     for(i = 0; i < runs; ++i)
+     {
+          f = home;
+          for(k = 0; k < 4; ++k)
+               hjkl[i * 4 + k] = key_latency(&ch, moves[k], has_moved, &f, &f);
+
+          f = read_face(&ch.vt);
+          x[i] = key_latency(&ch, 'x', box_changed, &f, &f);
+          key_latency(&ch, 'x', box_changed, &f, &f);
+
+          s[i] = key_latency(&ch, 's', ndigit_changed, &f, &f);
+          key_latency(&ch, 's', ndigit_changed, &f, &f);
+
+          /* Center, uncenter and walk back to where it started */
+          c[i] = key_latency(&ch, 'c', has_moved, &home, &f);
+          if(write(ch.fd, "c", 1) != 1)
+               break;
+          while(f.found && !at_position(&f, &home))
+               if(key_latency(&ch, (f.row > home.row) ? 'k' : 'h', has_moved, &f, &f) < 0)
+                    break;
+     }
+
+     result[2].value = median(hjkl, runs * 4);
+     result[3].value = median(s, runs);
+     result[4].value = median(c, runs);
+     result[5].value = median(x, runs);
+
+     reap(&ch);
+}
+
+Bool
+is_centered(face_t *f, face_t *ref)
+{
+     /* ref holds the terminal size */
+     return f->found
+          && f->row == ref->row / 2 - 7 / 2 + 1
+          && f->col == ref->col / 2 - NORMFRAMEW / 2 + 1;
+}
+
+void
+bench_resize(void)
+{
+     char *argv[] = { "tty-clock", "-c", NULL };
+     struct winsize ws[2] = { { ROWS + 6, COLS + 20, 0, 0 }, { ROWS, COLS, 0, 0 } };
+     double v[runs];
+     child_t ch;
+     face_t size;
+     double start;
+     int i;
+
+     if(!spawn(&ch, argv, ROWS, COLS))
+          return;
+
+     size.row = ROWS;
+     size.col = COLS;
+     if(wait_face(&ch, now_ms(), is_centered, &size, NULL) < 0)
+     {
+          reap(&ch);
+          return;
+     }
+
+     for(i = 0; i < runs; ++i)
+     {
+          /* The kernel sends SIGWINCH to tty-clock */
+          start = now_ms();
+          ioctl(ch.fd, TIOCSWINSZ, &ws[i % 2]);
+          vt_resize(&ch.vt, (size.row = ws[i % 2].ws_row), (size.col = ws[i % 2].ws_col));
+          v[i] = wait_face(&ch, start, is_centered, &size, NULL);
+     }
+
+     result[6].value = median(v, runs);
+
+     reap(&ch);
+}
+
+/*
+ * Baseline
+ */
+
+void
+write_baseline(const char *path)
+{
+     FILE *f;
+     size_t i;
+
+     if(!(f = fopen(path, "w")))
+     {
+          fprintf(stderr, "ttyclock-bench: error: '%s' couldn't be opened: %s.\n",
+                  path, strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+
+     fprintf(f, "# tty-clock end-to-end limits, see bench/ttyclock-bench.c\n"
+             "#\n"
+             "# Written by: bench/ttyclock-bench -w -b bench/baseline ./tty-clock\n"
+             "# Each limit is %d times the median measured, plus slack for the\n"
+             "# scheduler of a busy host. Key and resize latencies used to be bound\n"
+             "# by the 1s sleep of key_event(), bytes per frame by repainting every\n"
+             "# digit of the clock.\n", HEADROOM);
+     for(i = 0; i < NRESULT; ++i)
+          if(result[i].value >= 0)
+               fprintf(f, "%-16s %.0f\n", result[i].name,
+                       result[i].value * HEADROOM + result[i].slack + 1);
+
+     fclose(f);
+}
+
+int
+check_baseline(const char *path)
+{
+     FILE *f;
+     char line[256], name[64];
+     double limit[NRESULT];
+     size_t i;
+     double v;
+     int failed = 0;
+
+     for(i = 0; i < NRESULT; ++i)
+          limit[i] = -1;
+
+     if(path && (f = fopen(path, "r")))
+     {
+          while(fgets(line, sizeof(line), f))
+          {
+               if(*line == '#' || sscanf(line, "%63s %lf", name, &v) != 2)
+                    continue;
+               for(i = 0; i < NRESULT; ++i)
+                    if(!strcmp(name, result[i].name))
+                         limit[i] = v;
+          }
+          fclose(f);
+     }
+
+     for(i = 0; i < NRESULT; ++i)
+     {
+          const char *verdict = "ok";
+
+          if(result[i].value < 0)
+               verdict = "FAILED";
+          else if(limit[i] < 0)
+               verdict = "no baseline";
+          else if(result[i].value > limit[i])
+               verdict = "REGRESSION";
+
+          if(result[i].value < 0 || (limit[i] >= 0 && result[i].value > limit[i]))
+               ++failed;
+
+          printf("%-16s %10.2f %-5s  limit %8.0f  %s\n", result[i].name,
+                 result[i].value, result[i].unit, limit[i], verdict);
+     }
+
+     return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+     const char *baseline = NULL;
+     Bool update = False;
+     int c;
+
+     while((c = getopt(argc, argv, "wvb:t:n:h")) != -1)
+     {
+          switch(c)
+          {
+          case 'v':
+               verbose = True;
+               break;
+          case 'w':
+               update = True;
+               break;
+          case 'b':
+               baseline = optarg;
+               break;
+          case 't':
+               if(atoi(optarg) > 0)
+                    seconds = atoi(optarg);
+               break;
+          case 'n':
+               if(atoi(optarg) > 0 && atoi(optarg) < 100)
+                    runs = atoi(optarg);
+               break;
+          case 'h':
+          default:
+               printf("usage : ttyclock-bench [-wv] [-b baseline] [-t seconds] [-n runs] tty-clock\n"
+                      "    -b baseline   Compare with the limits in baseline            \n"
+                      "    -w            Write the baseline from this run instead       \n"
+                      "    -v            Show the emulated screen when a wait times out \n"
+                      "    -t seconds    Length of the bytes per frame run. Default 10s.\n"
+                      "    -n runs       Samples of each latency. Default 5.            \n");
+               exit(EXIT_SUCCESS);
+          }
+     }
+
+     if(optind >= argc)
+     {
+          fprintf(stderr, "ttyclock-bench: error: no tty-clock binary given.\n");
+          exit(EXIT_FAILURE);
+     }
+     binary = argv[optind];
+
+     signal(SIGPIPE, SIG_IGN);
+
+     bench_first_frame();
+     bench_keys();
+     bench_resize();
+     bench_bytes_per_frame();
+
+     if(update && baseline)
+     {
+          write_baseline(baseline);
+          printf("ttyclock-bench: baseline written to %s\n", baseline);
+          return 0;
+     }
+
+     return (check_baseline(baseline)) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// vim: expandtab tabstop=4 softtabstop=4 shiftwidth=4
@@ -0,0 +1,213 @@
+/*
+ *      TTY-CLOCK shared memory reader.
+ *      Copyright © 2009-2018 tty-clock contributors
+ *      All rights reserved.
+ *
+ *      Redistribution and use in source and binary forms, with or without
+ *      modification, are permitted provided that the following conditions are
+ *      met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following disclaimer
+ *        in the documentation and/or other materials provided with the
+ *        distribution.
+ *      * Neither the name of the  nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ *      THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *      "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *      LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *      A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *      OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *      SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *      LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *      DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *      THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *      (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *      OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Prints what a tty-clock started with --shm shows, for status lines and
+ * prompts that would otherwise fork date(1).
+ *
+ * usage : tty-clock-read [-dFj] [-n name] [-w ms]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ttyclock-shm.h"
+
+typedef enum { ShowTime, ShowDate, ShowFrame, ShowJson } show_t;
+
+/* Longest output of print_snapshot(), a datestr of \u escapes in JSON */
+#define OUTLEN 4096
+
+void
+print_snapshot(FILE *f, ttyclock_shm_t *s, show_t show)
+{
+     int x;
+
+     switch(show)
+     {
+     case ShowTime:
+          fprintf(f, "%d%d:%d%d", s->digit[0], s->digit[1], s->digit[2], s->digit[3]);
+          if(s->flags & SHM_SECOND)
+               fprintf(f, ":%d%d", s->digit[4], s->digit[5]);
+          fprintf(f, "%s\n", s->meridiem);
+          break;
+
+     case ShowDate:
+          fprintf(f, "%s\n", s->datestr);
+          break;
+
+     case ShowFrame:
+          for(x = 0; x < s->frameh && x < SHM_FRAMEH; ++x)
+               fprintf(f, "%.*s\n", SHM_FRAMEW, s->frame[x]);
+          break;
+
+     case ShowJson:
+          fprintf(f, "{ \"pid\": %u, \"seq\": %u, \"time\": %lld, \"nsec\": %d, "
+                    "\"year\": %d, \"mon\": %d, \"mday\": %d, \"wday\": %d, \"yday\": %d, "
+                    "\"hour\": %d, \"min\": %d, \"sec\": %d, \"isdst\": %d, \"gmtoff\": %lld, "
+                    "\"utc\": %s, \"twelve\": %s, \"datestr\": \"",
+                    s->pid, s->seq, (long long)s->time, s->nsec,
+                    s->year, s->mon, s->mday, s->wday, s->yday,
+                    s->hour, s->min, s->sec, s->isdst, (long long)s->gmtoff,
+                    (s->flags & SHM_UTC) ? "true" : "false",
+                    (s->flags & SHM_TWELVE) ? "true" : "false");
+          for(x = 0; x < (int)sizeof(s->datestr) && s->datestr[x]; ++x)
+               if(s->datestr[x] == '"' || s->datestr[x] == '\\')
+                    fprintf(f, "\\%c", s->datestr[x]);
+               else if((unsigned char)s->datestr[x] < ' ')
+                    fprintf(f, "\\u%04x", s->datestr[x]);
+               else
+                    fputc(s->datestr[x], f);
+          fprintf(f, "\" }\n");
+          break;
+     }
+
+     fflush(f);
+}
+
+int
+main(int argc, char **argv)
+{
+     char name[256];
+     const char *arg = NULL;
+     ttyclock_shm_t *shm, snap, key;
+     char out[2][OUTLEN] = { "", "" };
+     FILE *f;
+     show_t show = ShowTime;
+     struct timespec ts;
+     struct stat st;
+     uint32_t last = 1;
+     long watch = 0;
+     int c, fd, cur = 0;
+
+     while((c = getopt(argc, argv, "dFjn:w:h")) != -1)
+     {
+          switch(c)
+          {
+          case 'd':
+               show = ShowDate;
+               break;
+          case 'F':
+               show = ShowFrame;
+               break;
+          case 'j':
+               show = ShowJson;
+               break;
+          case 'n':
+               arg = optarg;
+               break;
+          case 'w':
+               if(atol(optarg) > 0)
+                    watch = atol(optarg);
+               break;
+          case 'h':
+          default:
+               printf("usage : tty-clock-read [-dFj] [-n name] [-w ms]        \n"
+                      "    -d            Print the date string                \n"
+                      "    -F            Print the clock face                 \n"
+                      "    -j            Print every field as JSON            \n"
+                      "    -n name       Read tty-clock --shm=name            \n"
+                      "    -w ms         Check every ms milliseconds and print\n"
+                      "                  each change                          \n");
+               exit(EXIT_SUCCESS);
+          }
+     }
+
+     if(!arg)
+          snprintf(name, sizeof(name), SHM_NAME, (unsigned int)getuid());
+     else
+          snprintf(name, sizeof(name), "%s%s", (*arg == '/') ? "" : "/", arg);
+
+     if((fd = shm_open(name, O_RDONLY, 0)) < 0
+        || fstat(fd, &st) < 0)
+     {
+          fprintf(stderr, "tty-clock-read: error: '%s' couldn't be opened: %s.\n",
+                  name, strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+
+     /* Mapping past the end of a shorter object would fault on access */
+     if(st.st_size < (off_t)sizeof(ttyclock_shm_t)
+        || (shm = mmap(NULL, sizeof(ttyclock_shm_t), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED
+        || shm->magic != SHM_MAGIC || shm->version != SHM_VERSION
+        || shm->size < sizeof(ttyclock_shm_t))
+     {
+          fprintf(stderr, "tty-clock-read: error: '%s' isn't a tty-clock version %d export.\n",
+                  name, SHM_VERSION);
+          exit(EXIT_FAILURE);
+     }
+     close(fd);
+
+     ts.tv_sec = watch / 1000;
+     ts.tv_nsec = (watch % 1000) * 1000000;
+
+     do
+     {
+          if(shm_read(shm, &snap) < 0)
+          {
+               fprintf(stderr, "tty-clock-read: error: '%s' is stuck in an update.\n", name);
+               exit(EXIT_FAILURE);
+          }
+
+          /* seq and nsec move on with every pass of tty-clock's main
+           * loop, print only when what is shown changes */
+          if(snap.seq != last)
+          {
+               key = snap;
+               key.seq = 0;
+               key.nsec = 0;
+               if((f = fmemopen(out[cur], OUTLEN, "w")))
+               {
+                    print_snapshot(f, &key, show);
+                    fclose(f);
+               }
+               if(!f || strcmp(out[cur], out[!cur]))
+               {
+                    print_snapshot(stdout, &snap, show);
+                    cur = !cur;
+               }
+          }
+          last = snap.seq;
+     } while(watch && !nanosleep(&ts, NULL));
+
+     return 0;
+}
+
+// vim: expandtab tabstop=4 softtabstop=4 shiftwidth=4
@@ -0,0 +1,119 @@
+/*
+ *      TTY-CLOCK shared memory layout.
+ *      Copyright © 2009-2018 tty-clock contributors
+ *      All rights reserved.
+ *
+ *      Redistribution and use in source and binary forms, with or without
+ *      modification, are permitted provided that the following conditions are
+ *      met:
+ *
+ *      * Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *      * Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following disclaimer
+ *        in the documentation and/or other materials provided with the
+ *        distribution.
+ *      * Neither the name of the  nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ *      THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *      "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *      LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *      A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *      OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *      SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *      LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *      DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *      THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *      (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *      OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TTYCLOCK_SHM_H_INCLUDED
+#define TTYCLOCK_SHM_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * tty-clock --shm publishes the time it shows in a POSIX shared memory
+ * object, by default named after the uid (see SHM_NAME). Readers map it
+ * read only and copy it under the seqlock below, which needs no system
+ * call at all.
+ *
+ * Fields are only ever added at the end, with size telling how much of
+ * the structure the writer knows about. version changes when a field
+ * changes meaning.
+ */
+
+#define SHM_MAGIC   0x6b636c74 /* "tlck" */
+#define SHM_VERSION 1
+#define SHM_NAME    "/tty-clock.%u"
+
+/* Clock face as drawn, less its border: '#' for a lit cell */
+#define SHM_FRAMEH  5
+#define SHM_FRAMEW  51
+
+/* flags */
+#define SHM_UTC     (1 << 0)
+#define SHM_TWELVE  (1 << 1)
+#define SHM_SECOND  (1 << 2)
+
+typedef struct
+{
+     uint32_t magic;
+     uint32_t version;
+     uint32_t size;
+     uint32_t pid;
+
+     /* Odd while the writer is in the middle of an update */
+     uint32_t seq;
+     uint32_t flags;
+
+     /* What update_hour() read */
+     int64_t time;
+     int32_t nsec;
+     int32_t year, mon, mday, wday, yday;
+     int32_t hour, min, sec;
+     int32_t isdst;
+     int64_t gmtoff;
+
+     /* What is shown */
+     uint8_t digit[6];
+     char meridiem[8];
+     char datestr[256];
+     uint16_t framew, frameh;
+     char frame[SHM_FRAMEH][SHM_FRAMEW + 1];
+} ttyclock_shm_t;
+
+/* Give up on a writer that died in the middle of an update */
+#define SHM_SPINS   (1 << 20)
+
+/* Copy the latest consistent snapshot of shm into out, -1 if there is
+ * none to be had */
+static inline int
+shm_read(const ttyclock_shm_t *shm, ttyclock_shm_t *out)
+{
+     uint32_t seq;
+     long i;
+
+     for(i = 0; i < SHM_SPINS; ++i)
+     {
+          seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+          if(seq & 1)
+               continue;
+
+          memcpy(out, (const void *)shm, sizeof(ttyclock_shm_t));
+
+          __atomic_thread_fence(__ATOMIC_ACQUIRE);
+          if(__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+               return 0;
+     }
+
+     return -1;
+}
+
+#endif /* TTYCLOCK_SHM_H_INCLUDED */
+
+// vim: expandtab tabstop=4 softtabstop=4 shiftwidth=4
@@ -50,8 +50,15 @@ init(void)
          ttyclock->ttyscr = newterm(NULL, ftty, ftty);
          assert(ttyclock->ttyscr != NULL);
          set_term(ttyclock->ttyscr);
-     } else
+         ttyclock->infd = fileno(ftty);
+     } else {
          initscr();
+         ttyclock->infd = STDIN_FILENO;
+     }
+
+     /* Input that isn't a terminal, e.g. /dev/null, would always be ready */
+     if(!isatty(ttyclock->infd))
+          ttyclock->infd = -1;
 
      cbreak();
      noecho();
@@ -66,8 +73,8 @@ init(void)
 
      /* Init color pair */
      init_pair(0, ttyclock->bg, ttyclock->bg);
-     init_pair(1, ttyclock->bg, ttyclock->option.color);
-     init_pair(2, ttyclock->option.color, ttyclock->bg);
+     init_pair(1, ttyclock->bg, clock_color());
+     init_pair(2, clock_color(), ttyclock->bg);
 //     init_pair(0, ttyclock->bg, ttyclock->bg);
 //     init_pair(1, ttyclock->bg, ttyclock->option.color);
 //     init_pair(2, ttyclock->option.color, ttyclock->bg);
@@ -80,6 +87,8 @@ init(void)
      sigaction(SIGTERM,  &sig, NULL);
      sigaction(SIGINT,   &sig, NULL);
      sigaction(SIGSEGV,  &sig, NULL);
+     if(ttyclock->stats.enabled)
+          sigaction(SIGUSR1, &sig, NULL);
 
      /* Init global struct */
      ttyclock->running = True;
@@ -105,6 +114,7 @@ init(void)
                                  ttyclock->geo.w,
                                  ttyclock->geo.x,
                                  ttyclock->geo.y);
+     clock_invalidate();
      if(ttyclock->option.box) {
            box(ttyclock->framewin, 0, 0);
      }
@@ -115,11 +125,10 @@ init(void)
      }
 
      /* Create the date win */
-     ttyclock->datewin = newwin(DATEWINH, strlen(ttyclock->date.datestr) + 2,
+     ttyclock->datewin = newwin(DATEWINH, strlen(date_text()) + 2,
                                 ttyclock->geo.x + ttyclock->geo.h - 1,
-                                ttyclock->geo.y + (ttyclock->geo.w / 2) -
-                                (strlen(ttyclock->date.datestr) / 2) - 1);
-     if(ttyclock->option.box && ttyclock->option.date) {
+                                date_y());
+     if(ttyclock->option.box && date_shown()) {
           box(ttyclock->datewin, 0, 0);
      }
      clearok(ttyclock->datewin, True);
@@ -128,7 +137,7 @@ init(void)
 
      nodelay(stdscr, True);
 
-     if (ttyclock->option.date)
+     if (date_shown())
      {
           wrefresh(ttyclock->datewin);
      }
@@ -158,6 +167,10 @@ signal_handler(int signal)
           fprintf(stderr, "Segmentation fault.\n");
           exit(EXIT_FAILURE);
           break;
+          /* Stats are written from the main loop, not from here */
+     case SIGUSR1:
+          ttyclock->stats.dump = True;
+          break;
      }
 
      return;
@@ -173,6 +186,24 @@ cleanup(void)
         free(ttyclock->tty);
     if (ttyclock && ttyclock->option.format)
         free(ttyclock->option.format);
+    if (ttyclock && ttyclock->stats.file)
+        free(ttyclock->stats.file);
+    if (ttyclock && ttyclock->step.fd >= 0)
+        close(ttyclock->step.fd);
+    if (ttyclock && ttyclock->shm.map) {
+        if (ttyclock->shm.map->pid == (uint32_t)getpid())
+            shm_unlink(ttyclock->shm.name);
+        munmap(ttyclock->shm.map, sizeof(ttyclock_shm_t));
+    }
+    if (ttyclock && ttyclock->shm.name)
+        free(ttyclock->shm.name);
+    if (ttyclock && ttyclock->alarm.load)
+        fclose(ttyclock->alarm.load);
+    if (ttyclock && ttyclock->alarm.file) {
+        free(ttyclock->alarm.file);
+        free(ttyclock->alarm.set);
+        free(ttyclock->alarm.next);
+    }
     if (ttyclock)
         free(ttyclock);
 }
@@ -182,8 +213,11 @@ update_hour(void)
 {
      int ihour;
      char tmpstr[128];
+     struct timespec ts;
 
-     ttyclock->lt = time(NULL);
+     clock_gettime(CLOCK_REALTIME, &ts);
+     ttyclock->lt = ts.tv_sec;
+     ttyclock->nsec = ts.tv_nsec;
      ttyclock->tm = localtime(&(ttyclock->lt));
      if(ttyclock->option.utc) {
          ttyclock->tm = gmtime(&(ttyclock->lt));
@@ -197,8 +231,7 @@ update_hour(void)
           ttyclock->meridiem = "\0";
 
      /* Manage hour for twelve mode */
-     ihour = ((ttyclock->option.twelve && ihour > 12)  ? (ihour - 12) : ihour);
-     ihour = ((ttyclock->option.twelve && !ihour) ? 12 : ihour);
+     ihour = twelve_hour(ihour);
 
      /* Set hour */
      ttyclock->date.hour[0] = ihour / 10;
@@ -219,6 +252,42 @@ update_hour(void)
      ttyclock->date.second[0] = ttyclock->tm->tm_sec / 10;
      ttyclock->date.second[1] = ttyclock->tm->tm_sec % 10;
 
+     anim_update();
+
+     return;
+}
+
+int
+twelve_hour(int hour)
+{
+     hour = ((ttyclock->option.twelve && hour > 12)  ? (hour - 12) : hour);
+     hour = ((ttyclock->option.twelve && !hour) ? 12 : hour);
+
+     return hour;
+}
+
+/* Digits of the next second, where animations are heading to */
+void
+next_digits(unsigned int *digit)
+{
+     struct tm tm;
+     time_t t = ttyclock->lt + 1;
+     int hour;
+
+     if(ttyclock->option.utc)
+          gmtime_r(&t, &tm);
+     else
+          localtime_r(&t, &tm);
+
+     hour = twelve_hour(tm.tm_hour);
+
+     digit[SlotHour0]   = hour / 10;
+     digit[SlotHour1]   = hour % 10;
+     digit[SlotMinute0] = tm.tm_min / 10;
+     digit[SlotMinute1] = tm.tm_min % 10;
+     digit[SlotSecond0] = tm.tm_sec / 10;
+     digit[SlotSecond1] = tm.tm_sec % 10;
+
      return;
 }
 
@@ -227,6 +296,11 @@ draw_number(int n, int x, int y)
 {
      int i, sy = y;
 
+     if (ttyclock->option.bold)
+          wattron(ttyclock->framewin, A_BLINK);
+     else
+          wattroff(ttyclock->framewin, A_BLINK);
+
      for(i = 0; i < 30; ++i, ++sy)
      {
           if(sy == y + 6)
@@ -235,15 +309,291 @@ draw_number(int n, int x, int y)
                ++x;
           }
 
-          if (ttyclock->option.bold)
-               wattron(ttyclock->framewin, A_BLINK);
-          else
-               wattroff(ttyclock->framewin, A_BLINK);
-
           wbkgdset(ttyclock->framewin, COLOR_PAIR(number[n][i/2]));
           mvwaddch(ttyclock->framewin, x, sy, ' ');
      }
-     wrefresh(ttyclock->framewin);
+
+     return;
+}
+
+/* Draw digit n in slot s, only touching the cells that changed since the
+ * digit previously drawn there. During an animation the slot gets the
+ * current frame of its transition instead. */
+void
+draw_digit(Slot s, int n, int x, int y)
+{
+     Anim a = ttyclock->anim.style;
+     int next = ttyclock->anim.next[s];
+
+     if(ttyclock->anim.frame && next != n)
+     {
+          draw_frame(s, anim_frame[a][n][next][ttyclock->anim.frame - 1], x, y);
+          return;
+     }
+
+     if(ttyclock->drawn[s] < 0)
+     {
+          draw_number(n, x, y);
+          ttyclock->anim.cells += 15;
+     }
+     else
+          /* Only the cells that differ from what the slot shows */
+          draw_cells(ttyclock->shown[s] ^ digit_mask[n], digit_mask[n], x, y);
+
+     ttyclock->drawn[s] = n;
+     ttyclock->shown[s] = digit_mask[n];
+
+     return;
+}
+
+/* Draw the cells of mask in slot s, e.g. an animation frame */
+void
+draw_frame(Slot s, uint16_t mask, int x, int y)
+{
+     draw_cells((ttyclock->drawn[s] < 0) ? 0x7fff : ttyclock->shown[s] ^ mask, mask, x, y);
+     ttyclock->shown[s] = mask;
+
+     return;
+}
+
+/* Paint the cells set in flip, lit if they are set in mask too */
+void
+draw_cells(uint16_t flip, uint16_t mask, int x, int y)
+{
+     int i;
+
+     if(!flip)
+          return;
+
+     if (ttyclock->option.bold)
+          wattron(ttyclock->framewin, A_BLINK);
+     else
+          wattroff(ttyclock->framewin, A_BLINK);
+
+     for(i = 0; flip; ++i, flip >>= 1)
+          if(flip & 1)
+          {
+               wbkgdset(ttyclock->framewin, COLOR_PAIR((mask >> i) & 1));
+               mvwaddstr(ttyclock->framewin, x + i / 3, y + (i % 3) * 2, "  ");
+               ++ttyclock->anim.cells;
+          }
+
+     return;
+}
+
+/* Build digit_mask[] and the animation frames from the number matrix,
+ * once at startup */
+void
+init_transitions(void)
+{
+     /* Order in which cells flip when fading */
+     const int dither[15] = { 0, 14, 7, 2, 12, 4, 10, 6, 8, 1, 13, 3, 11, 5, 9 };
+     int from, to, i, k, r, c, src, done, ndiff;
+     uint16_t diff, f;
+
+     for(from = 0; from < 10; ++from)
+          for(i = 0; i < 15; ++i)
+               if(number[from][i])
+                    digit_mask[from] |= 1 << i;
+
+     for(from = 0; from < 10; ++from)
+          for(to = 0; to < 10; ++to)
+          {
+               /* Slide: the new digit pushes the old one out to the left */
+               for(k = 1; k <= anim_frames[AnimSlide]; ++k)
+               {
+                    for(f = 0, i = 0; i < 15; ++i)
+                    {
+                         r = i / 3;
+                         src = i % 3 + k;
+                         if((src < 3) ? number[from][r * 3 + src] : number[to][r * 3 + src - 3])
+                              f |= 1 << i;
+                    }
+                    anim_frame[AnimSlide][from][to][k - 1] = f;
+               }
+
+               /* Roll: the new digit comes up from below */
+               for(k = 1; k <= anim_frames[AnimRoll]; ++k)
+               {
+                    for(f = 0, i = 0; i < 15; ++i)
+                    {
+                         c = i % 3;
+                         src = i / 3 + k;
+                         if((src < 5) ? number[from][src * 3 + c] : number[to][(src - 5) * 3 + c])
+                              f |= 1 << i;
+                    }
+                    anim_frame[AnimRoll][from][to][k - 1] = f;
+               }
+
+               /* Fade: the cells that differ flip a few at a time */
+               diff = digit_mask[from] ^ digit_mask[to];
+               for(ndiff = 0, i = 0; i < 15; ++i)
+                    ndiff += (diff >> i) & 1;
+               for(k = 1; k <= anim_frames[AnimFade]; ++k)
+               {
+                    f = digit_mask[from];
+                    for(done = 0, i = 0; i < 15; ++i)
+                         if(((diff >> dither[i]) & 1)
+                            && done++ < k * ndiff / (anim_frames[AnimFade] + 1))
+                              f ^= 1 << dither[i];
+                    anim_frame[AnimFade][from][to][k - 1] = f;
+               }
+          }
+
+     return;
+}
+
+/* Intermediate frames drawn per transition at the current quality */
+int
+anim_length(void)
+{
+     if(!ttyclock->anim.stride)
+          return 0;
+
+     return anim_frames[ttyclock->anim.style] / ttyclock->anim.stride;
+}
+
+/* Pick the animation frame to draw, if any, from the time update_hour()
+ * just read. Transitions end on the second edge, where the new digits get
+ * drawn, so they never make the time shown late. */
+void
+anim_update(void)
+{
+     unsigned int digit[SlotLast];
+     int len = anim_length();
+     int s, last = (ttyclock->option.second) ? SlotLast : SlotSecond0;
+     uint64_t rem, span, k;
+
+     ttyclock->anim.frame = 0;
+     ttyclock->anim.pending = False;
+
+     if(!len)
+          return;
+
+     memcpy(digit, ttyclock->date.hour, sizeof(ttyclock->date.hour));
+     memcpy(digit + 2, ttyclock->date.minute, sizeof(ttyclock->date.minute));
+     memcpy(digit + 4, ttyclock->date.second, sizeof(ttyclock->date.second));
+     next_digits(ttyclock->anim.next);
+
+     for(s = 0; s < last; ++s)
+          if(ttyclock->anim.next[s] != digit[s])
+               ttyclock->anim.pending = True;
+
+     if(!ttyclock->anim.pending)
+          return;
+
+     rem = 1000000000 - ttyclock->nsec;
+     span = (uint64_t)len * 1000000000 / ttyclock->anim.fps;
+     if(rem > span)
+          return;
+
+     k = (span - rem) * ttyclock->anim.fps / 1000000000 + 1;
+     if(k > (uint64_t)len)
+          k = len;
+     ttyclock->anim.frame = k * ttyclock->anim.stride;
+
+     return;
+}
+
+/* Nanoseconds until the next animation frame, or the second edge ending
+ * it, UINT64_MAX when nothing is animated */
+uint64_t
+anim_deadline(void)
+{
+     struct timespec ts;
+     int len = anim_length();
+     uint64_t rem, span, elapsed, k;
+
+     if(!len || !ttyclock->anim.pending)
+          return UINT64_MAX;
+
+     clock_gettime(CLOCK_REALTIME, &ts);
+     if(ts.tv_sec != ttyclock->lt)
+          return 0;
+
+     rem = 1000000000 - ts.tv_nsec;
+     span = (uint64_t)len * 1000000000 / ttyclock->anim.fps;
+     if(rem > span)
+          return rem - span;
+
+     elapsed = span - rem;
+     k = elapsed * ttyclock->anim.fps / 1000000000 + 1;
+     if(k >= (uint64_t)len)
+          return rem;
+
+     return k * 1000000000 / ttyclock->anim.fps - elapsed;
+}
+
+/* Check the frame drawn since start against the budget of an animation
+ * frame: drop frames when it doesn't fit, add them back when it does */
+void
+anim_account(uint64_t start)
+{
+     uint64_t budget;
+     Bool over;
+
+     if(ttyclock->anim.style == AnimNone)
+          return;
+
+     budget = 1000000000 / ttyclock->anim.fps / 2;
+     over = (clock_now() - start > budget
+             || ttyclock->anim.cells * ANIM_CELLBYTES > ANIM_BYTEBUDGET);
+     ttyclock->anim.cells = 0;
+
+     if(ttyclock->anim.frame)
+          ++ttyclock->anim.frames;
+
+     if(!over)
+     {
+          ttyclock->anim.overrun = 0;
+          if(++ttyclock->anim.ontime >= ANIM_RECOVER && ttyclock->anim.stride != 1)
+          {
+               ttyclock->anim.stride = (ttyclock->anim.stride) ? 1 : 2;
+               ttyclock->anim.ontime = 0;
+          }
+     }
+     else
+     {
+          ttyclock->anim.ontime = 0;
+          if(ttyclock->anim.frame && ++ttyclock->anim.overrun >= ANIM_OVERRUNS)
+          {
+               ttyclock->anim.stride = (ttyclock->anim.stride == 1) ? 2 : 0;
+               ttyclock->anim.overrun = 0;
+               ++ttyclock->anim.drops;
+          }
+     }
+
+     return;
+}
+
+/* Shorten a sleep of length to the next deadline of the clock */
+void
+clock_timeout(struct timespec *length)
+{
+     uint64_t ns = (uint64_t)length->tv_sec * 1000000000 + length->tv_nsec;
+     uint64_t deadline = anim_deadline();
+     uint64_t ring = alarm_deadline();
+
+     if(ring < deadline)
+          deadline = ring;
+
+     if(deadline < ns)
+     {
+          length->tv_sec = deadline / 1000000000;
+          length->tv_nsec = deadline % 1000000000;
+     }
+
+     return;
+}
+
+/* Forget what is on screen, the next draw_clock() draws every digit */
+void
+clock_invalidate(void)
+{
+     int s;
+
+     for(s = 0; s < SlotLast; ++s)
+          ttyclock->drawn[s] = -1;
 
      return;
 }
@@ -252,8 +602,8 @@ void
 draw_clock(void)
 {
      /* Draw hour numbers */
-     draw_number(ttyclock->date.hour[0], 1, 1);
-     draw_number(ttyclock->date.hour[1], 1, 8);
+     draw_digit(SlotHour0, ttyclock->date.hour[0], 1, 1);
+     draw_digit(SlotHour1, ttyclock->date.hour[1], 1, 8);
      chtype dotcolor = COLOR_PAIR(1);
      if (ttyclock->option.blink && time(NULL) % 2 == 0)
           dotcolor = COLOR_PAIR(2);
@@ -264,8 +614,8 @@ draw_clock(void)
      mvwaddstr(ttyclock->framewin, 4, 16, "  ");
 
      /* Draw minute numbers */
-     draw_number(ttyclock->date.minute[0], 1, 20);
-     draw_number(ttyclock->date.minute[1], 1, 27);
+     draw_digit(SlotMinute0, ttyclock->date.minute[0], 1, 20);
+     draw_digit(SlotMinute1, ttyclock->date.minute[1], 1, 27);
 
      /* Draw the date */
      if (ttyclock->option.bold)
@@ -273,11 +623,16 @@ draw_clock(void)
      else
           wattroff(ttyclock->datewin, A_BOLD);
 
-     if (ttyclock->option.date)
+     /* A ringing alarm flashes */
+     if (ttyclock->alarm.ringing && ttyclock->lt % 2)
+          wattron(ttyclock->datewin, A_REVERSE);
+     else
+          wattroff(ttyclock->datewin, A_REVERSE);
+
+     if (date_shown())
      {
           wbkgdset(ttyclock->datewin, (COLOR_PAIR(2)));
-          mvwprintw(ttyclock->datewin, (DATEWINH / 2), 1, ttyclock->date.datestr);
-          wrefresh(ttyclock->datewin);
+          mvwprintw(ttyclock->datewin, (DATEWINH / 2), 1, "%s", date_text());
      }
 
      /* Draw second if the option is enable */
@@ -289,10 +644,18 @@ draw_clock(void)
           mvwaddstr(ttyclock->framewin, 4, NORMFRAMEW, "  ");
 
           /* Draw second numbers */
-          draw_number(ttyclock->date.second[0], 1, 39);
-          draw_number(ttyclock->date.second[1], 1, 46);
+          draw_digit(SlotSecond0, ttyclock->date.second[0], 1, 39);
+          draw_digit(SlotSecond1, ttyclock->date.second[1], 1, 46);
      }
 
+     /* The screen itself is updated once per frame by doupdate(). stdscr
+      * goes first: after a resize ncurses leaves it touched, and if wgetch()
+      * refreshed it later it would wipe digits that are not redrawn. */
+     wnoutrefresh(stdscr);
+     wnoutrefresh(ttyclock->framewin);
+     if (date_shown())
+          wnoutrefresh(ttyclock->datewin);
+
      return;
 }
 
@@ -305,8 +668,9 @@ clock_move(int x, int y, int w, int h)
      wborder(ttyclock->framewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
      werase(ttyclock->framewin);
      wrefresh(ttyclock->framewin);
+     clock_invalidate();
 
-     if (ttyclock->option.date)
+     if (date_shown())
      {
           wbkgdset(ttyclock->datewin, COLOR_PAIR(0));
           wborder(ttyclock->datewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
@@ -319,12 +683,12 @@ clock_move(int x, int y, int w, int h)
      wresize(ttyclock->framewin, (ttyclock->geo.h = h), (ttyclock->geo.w = w));
 
      /* Date win move */
-     if (ttyclock->option.date)
+     if (date_shown())
      {
           mvwin(ttyclock->datewin,
                 ttyclock->geo.x + ttyclock->geo.h - 1,
-                ttyclock->geo.y + (ttyclock->geo.w / 2) - (strlen(ttyclock->date.datestr) / 2) - 1);
-          wresize(ttyclock->datewin, DATEWINH, strlen(ttyclock->date.datestr) + 2);
+                date_y());
+          wresize(ttyclock->datewin, DATEWINH, strlen(date_text()) + 2);
 
           if (ttyclock->option.box) {
             box(ttyclock->datewin,  0, 0);
@@ -345,9 +709,19 @@ clock_move(int x, int y, int w, int h)
 void
 clock_rebound(void)
 {
+     uint64_t now;
+
      if(!ttyclock->option.rebound)
           return;
 
+     /* One step per -d and -a, the loop also wakes up for animation
+      * frames, keys and alarms */
+     now = clock_now();
+     if(now < ttyclock->geo.next)
+          return;
+     ttyclock->geo.next = now + (uint64_t)ttyclock->option.delay * 1000000000
+          + ttyclock->option.nsdelay;
+
      if(ttyclock->geo.x < 1)
           ttyclock->geo.a = 1;
      if(ttyclock->geo.x > (LINES - ttyclock->geo.h - DATEWINH))
@@ -426,6 +800,8 @@ key_event(void)
 
      struct timespec length = { ttyclock->option.delay, ttyclock->option.nsdelay };
 
+     clock_timeout(&length);
+
      if (ttyclock->option.screensaver)
      {
           c = wgetch(stdscr);
@@ -435,7 +811,7 @@ key_event(void)
           }
           else
           {
-               nanosleep(&length, NULL);
+               clock_wait(&length);
                for(i = 0; i < 8; ++i)
                     if(c == (i + '0'))
                     {
@@ -509,6 +885,7 @@ key_event(void)
      case 'b':
      case 'B':
           ttyclock->option.bold = !ttyclock->option.bold;
+          clock_invalidate();
           break;
 
      case 'r':
@@ -523,8 +900,14 @@ key_event(void)
           set_box(!ttyclock->option.box);
           break;
 
+     case 'a':
+     case 'A':
+          if(ttyclock->alarm.ringing)
+               alarm_ring(NULL);
+          break;
+
      default:
-          nanosleep(&length, NULL);
+          clock_wait(&length);
           for(i = 0; i < 8; ++i)
                if(c == (i + '0'))
                {
@@ -538,85 +921,1152 @@ key_event(void)
      return;
 }
 
-int
-main(int argc, char **argv)
+/* Render the clock as text into buf for --stdout, with ANSI colors unless
+ * --plain. With first False the cursor is first moved back over the
+ * previous frame so that a terminal redraws it in place. */
+size_t
+render_frame(char *buf, size_t size, Bool first)
 {
-     int c;
+     const int col[SlotLast] = { 1, 8, 20, 27, 39, 46 };
+     unsigned int digit[SlotLast];
+     int w = (ttyclock->option.second) ? SECFRAMEW : NORMFRAMEW;
+     int nslot = (ttyclock->option.second) ? SlotLast : SlotSecond0;
+     int x, y, s, pad, n = 0;
+     Bool lit, on, colon;
+
+     memcpy(digit, ttyclock->date.hour, sizeof(ttyclock->date.hour));
+     memcpy(digit + 2, ttyclock->date.minute, sizeof(ttyclock->date.minute));
+     memcpy(digit + 4, ttyclock->date.second, sizeof(ttyclock->date.second));
+
+     colon = !(ttyclock->option.blink && ttyclock->lt % 2 == 0);
+
+#define PUT(...) \
+     do { \
+          n += snprintf(buf + n, size - n, __VA_ARGS__); \
+          if((size_t)n >= size) \
+               return size - 1; \
+     } while(0)
+
+     if(!first && !ttyclock->option.plain)
+          PUT("\033[%dA\r", (ttyclock->option.date) ? 7 : 5);
+     else if(!first)
+          PUT("\n");
+
+     /* Same layout as the frame window, less its border */
+     for(x = 1; x < 6; ++x)
+     {
+          on = False;
+          for(y = 1; y < w - 2; ++y)
+          {
+               lit = False;
+               for(s = 0; s < nslot; ++s)
+                    if(y >= col[s] && y < col[s] + 6)
+                         lit = number[digit[s]][(x - 1) * 3 + (y - col[s]) / 2];
+               if((x == 2 || x == 4) && colon
+                  && ((y >= 16 && y < 18) || (nslot == SlotLast && y >= NORMFRAMEW && y < NORMFRAMEW + 2)))
+                    lit = True;
+
+               if(ttyclock->option.plain)
+                    PUT("%c", lit ? '#' : ' ');
+               else
+               {
+                    if(lit != on)
+                         PUT("\033[%dm", lit ? (ttyclock->option.bold ? 100 : 40) + ttyclock->option.color : 49);
+                    PUT(" ");
+                    on = lit;
+               }
+          }
+          PUT("%s\n", (on) ? "\033[0m" : "");
+     }
 
-     /* Alloc ttyclock */
-     ttyclock = malloc(sizeof(ttyclock_t));
-     assert(ttyclock != NULL);
-     memset(ttyclock, 0, sizeof(ttyclock_t));
+     if(ttyclock->option.date)
+     {
+          pad = (w - 3 - (int)strlen(ttyclock->date.datestr)) / 2;
+          if(pad < 0)
+               pad = 0;
+          if(ttyclock->option.plain)
+               PUT("\n%*s%s\n", pad, "", ttyclock->date.datestr);
+          else
+               PUT("\033[K\n\033[K%*s\033[%s3%dm%s\033[0m\n", pad, "",
+                   (ttyclock->option.bold) ? "1;" : "", ttyclock->option.color,
+                   ttyclock->date.datestr);
+     }
 
-     ttyclock->option.date = True;
+#undef PUT
 
-     /* Date format */
-     ttyclock->option.format = malloc(sizeof(char) * 100);
-     /* Default date format */
-     strncpy(ttyclock->option.format, "%F", 100);
-     /* Default color */
-     ttyclock->option.color = COLOR_GREEN; /* COLOR_GREEN = 2 */
-     /* Default delay */
-     ttyclock->option.delay = 1; /* 1FPS */
-     ttyclock->option.nsdelay = 0; /* -0FPS */
-     ttyclock->option.blink = False;
+     return n;
+}
 
-     atexit(cleanup);
+/* --stdout: print the clock once, or every interval ms, without curses */
+void
+stream_clock(void)
+{
+     char buf[STDOUTBUFSIZ];
+     struct timespec ts;
+     ssize_t len, off, ret;
+     uint64_t next = 0, now;
+     Bool first = True;
 
-     while ((c = getopt(argc, argv, "iuvsScbtrhBxnDC:f:d:T:a:")) != -1)
+     for(;;)
      {
-          switch(c)
+          update_hour();
+          len = render_frame(buf, sizeof(buf), first);
+
+          /* One write per frame */
+          for(off = 0; off < len; off += ret)
+               if((ret = write(STDOUT_FILENO, buf + off, len - off)) < 0)
+               {
+                    if(errno == EINTR)
+                         ret = 0;
+                    else
+                         return;
+               }
+
+          if(ttyclock->option.interval <= 0)
+               return;
+          first = False;
+
+          /* Sleep to the next multiple of the interval, so it doesn't drift */
+          now = clock_now();
+          if(!next)
+               next = now;
+          next += (uint64_t)ttyclock->option.interval * 1000000;
+          if(next <= now)
+               next = now;
+          ts.tv_sec = (next - now) / 1000000000;
+          ts.tv_nsec = (next - now) % 1000000000;
+          nanosleep(&ts, NULL);
+     }
+}
+
+/* Sleep for length, or less on input or when the wall clock is set */
+void
+clock_wait(struct timespec *length)
+{
+     uint64_t start = stats_now();
+
+     ttyclock->stats.timeout = (uint64_t)length->tv_sec * 1000000000 + length->tv_nsec;
+#ifdef __linux__
+     uint64_t expired;
+     int n;
+     struct pollfd pfd[2] =
+     {
+          { ttyclock->infd,   POLLIN, 0 },
+          { ttyclock->step.fd, POLLIN, 0 }
+     };
+
+     n = ppoll(pfd, 2, length, NULL);
+     ttyclock->stats.timedout = (n == 0);
+
+     /* A terminal that went away stays ready, stop waiting on it */
+     if(n > 0 && (pfd[0].revents & (POLLHUP | POLLERR | POLLNVAL)))
+          ttyclock->infd = -1;
+
+     if(n > 0 && pfd[1].revents)
+     {
+          /* ECANCELED here means the clock was set, arm the timer again */
+          if(read(ttyclock->step.fd, &expired, sizeof(expired)) < 0 && errno != ECANCELED)
           {
-          case 'h':
-          default:
-               printf("usage : tty-clock [-iuvsScbtrahDBxn] [-C [0-7]] [-f format] [-d delay] [-a nsdelay] [-T tty] \n"
-                      "    -s            Show seconds                                   \n"
-                      "    -S            Screensaver mode                               \n"
-                      "    -x            Show box                                       \n"
-                      "    -c            Set the clock at the center of the terminal    \n"
-                      "    -C [0-7]      Set the clock color                            \n"
-                      "    -b            Use bold colors                                \n"
-                      "    -t            Set the hour in 12h format                     \n"
-                      "    -u            Use UTC time                                   \n"
-              "    -T tty        Display the clock on the specified terminal    \n"
-                      "    -r            Do rebound the clock                           \n"
-                      "    -f format     Set the date format                            \n"
-              "    -n            Don't quit on keypress                         \n"
-                      "    -v            Show tty-clock version                         \n"
-                      "    -i            Show some info about tty-clock                 \n"
-                      "    -h            Show this page                                 \n"
-                      "    -D            Hide date                                      \n"
-                      "    -B            Enable blinking colon                          \n"
-                      "    -d delay      Set the delay between two redraws of the clock. Default 1s. \n"
-                      "    -a nsdelay    Additional delay between two redraws in nanoseconds. Default 0ns.\n");
-               exit(EXIT_SUCCESS);
-               break;
-          case 'i':
-               puts("TTY-Clock 2 © by Martin Duquesnoy (xorg62@gmail.com), Grey (grey@greytheory.net)");
-               exit(EXIT_SUCCESS);
-               break;
-          case 'u':
-               ttyclock->option.utc = True;
-               break;
-          case 'v':
-               puts("TTY-Clock 2 © devel version");
-               exit(EXIT_SUCCESS);
-               break;
-          case 's':
-               ttyclock->option.second = True;
-               break;
-          case 'S':
-               ttyclock->option.screensaver = True;
-               break;
-          case 'c':
-               ttyclock->option.center = True;
-               break;
-          case 'b':
-               ttyclock->option.bold = True;
-               break;
-          case 'C':
-               if(atoi(optarg) >= 0 && atoi(optarg) < 8)
-                    ttyclock->option.color = atoi(optarg);
+               close(ttyclock->step.fd);
+               ttyclock->step.fd = -1;
+          }
+          clock_watch();
+          clock_step(True);
+     }
+     else
+          clock_step(False);
+#else
+     ttyclock->stats.timedout = !nanosleep(length, NULL);
+     clock_step(False);
+#endif /* __linux__ */
+
+     if(ttyclock->stats.enabled)
+     {
+          ttyclock->stats.slept = stats_now() - start;
+          stats_record(PhaseSleep, ttyclock->stats.slept);
+     }
+
+     return;
+}
+
+/* Ask the kernel to tell us about CLOCK_REALTIME being set, which also
+ * happens on resume from suspend */
+void
+clock_watch(void)
+{
+#ifdef __linux__
+     struct itimerspec its;
+
+     if(ttyclock->step.fd < 0
+        && (ttyclock->step.fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+          return;
+
+     /* Never meant to expire, only to be cancelled */
+     memset(&its, 0, sizeof(its));
+     its.it_value.tv_sec = time(NULL) + 3600 * 24 * 365;
+
+     if(timerfd_settime(ttyclock->step.fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                        &its, NULL) < 0)
+     {
+          close(ttyclock->step.fd);
+          ttyclock->step.fd = -1;
+     }
+#endif /* __linux__ */
+
+     if(!ttyclock->step.offset)
+          ttyclock->step.offset = clock_offset();
+
+     return;
+}
+
+/* CLOCK_REALTIME - CLOCK_MONOTONIC in nanoseconds */
+int64_t
+clock_offset(void)
+{
+     struct timespec rt, mt;
+
+     clock_gettime(CLOCK_MONOTONIC, &mt);
+     clock_gettime(CLOCK_REALTIME, &rt);
+
+     return ((int64_t)rt.tv_sec - mt.tv_sec) * 1000000000 + (rt.tv_nsec - mt.tv_nsec);
+}
+
+/* Log a wall clock step since the last call, True if there was one */
+Bool
+clock_step(Bool notified)
+{
+     int64_t offset = clock_offset();
+     int64_t delta = offset - ttyclock->step.offset;
+
+     ttyclock->step.offset = offset;
+
+     if(!notified && delta > -CLOCKSTEP_MIN && delta < CLOCKSTEP_MIN)
+          return False;
+
+     ttyclock->step.last[ttyclock->step.count++ % CLOCKSTEP_LOG] = delta;
+
+     return True;
+}
+
+/* Create the shared memory object of --shm */
+void
+init_shm(void)
+{
+     char name[256];
+     ttyclock_shm_t *shm;
+     int fd;
+
+     if(!ttyclock->shm.name)
+          snprintf(name, sizeof(name), SHM_NAME, (unsigned int)getuid());
+     else
+          snprintf(name, sizeof(name), "%s%s",
+                   (*ttyclock->shm.name == '/') ? "" : "/", ttyclock->shm.name);
+     free(ttyclock->shm.name);
+     ttyclock->shm.name = strdup(name);
+
+     /* Always a new object: one made by another user could be written to
+      * by them, and a second writer would break the seqlock */
+     while((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0 && errno == EEXIST)
+          if(!shm_reclaim(name))
+          {
+               fprintf(stderr, "tty-clock: error: shared memory '%s' is in use, "
+                       "or isn't a tty-clock one of yours.\n", name);
+               exit(EXIT_FAILURE);
+          }
+
+     if(fd < 0
+        || ftruncate(fd, sizeof(ttyclock_shm_t)) < 0
+        || (shm = mmap(NULL, sizeof(ttyclock_shm_t), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0)) == MAP_FAILED)
+     {
+          fprintf(stderr, "tty-clock: error: shared memory '%s' couldn't be set up: %s.\n",
+                  name, strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+     close(fd);
+
+     /* Claim it before the first publish_shm(), see shm_reclaim() */
+     shm->magic = SHM_MAGIC;
+     shm->pid = getpid();
+     ttyclock->shm.map = shm;
+
+     return;
+}
+
+/* Unlink the object already there under name if it is one of ours left
+ * over by a tty-clock that is gone. False when it has to stay. */
+Bool
+shm_reclaim(const char *name)
+{
+     ttyclock_shm_t *old;
+     struct stat st;
+     Bool stale;
+     int fd;
+
+     if((fd = shm_open(name, O_RDONLY, 0)) < 0)
+          return (errno == ENOENT);
+
+     if(fstat(fd, &st) < 0 || st.st_uid != getuid())
+     {
+          close(fd);
+          return False;
+     }
+
+     /* Empty when its writer died before it could claim it */
+     stale = (st.st_size == 0);
+     if(st.st_size >= (off_t)sizeof(ttyclock_shm_t)
+        && (old = mmap(NULL, sizeof(ttyclock_shm_t), PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED)
+     {
+          stale = (old->magic == SHM_MAGIC
+                   && kill(old->pid, 0) < 0 && errno == ESRCH);
+          munmap(old, sizeof(ttyclock_shm_t));
+     }
+     close(fd);
+
+     return stale && (shm_unlink(name) == 0 || errno == ENOENT);
+}
+
+/* Copy the time and the clock face into the --shm object */
+void
+publish_shm(void)
+{
+     const int col[SlotLast] = { 0, 7, 19, 26, 38, 45 };
+     ttyclock_shm_t *shm = ttyclock->shm.map;
+     int w = (ttyclock->option.second) ? SECFRAMEW - 3 : NORMFRAMEW - 3;
+     int nslot = (ttyclock->option.second) ? SlotLast : SlotSecond0;
+     char colon = (ttyclock->option.blink && ttyclock->lt % 2 == 0) ? ' ' : '#';
+     uint16_t mask;
+     int s, i, x;
+
+     if(!shm)
+          return;
+
+     /* Seqlock: odd while writing */
+     __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+     __atomic_thread_fence(__ATOMIC_RELEASE);
+
+     shm->magic   = SHM_MAGIC;
+     shm->version = SHM_VERSION;
+     shm->size    = sizeof(ttyclock_shm_t);
+     shm->pid     = getpid();
+     shm->flags   = ((ttyclock->option.utc) ? SHM_UTC : 0)
+          | ((ttyclock->option.twelve) ? SHM_TWELVE : 0)
+          | ((ttyclock->option.second) ? SHM_SECOND : 0);
+
+     shm->time   = ttyclock->lt;
+     shm->nsec   = ttyclock->nsec;
+     shm->year   = ttyclock->tm->tm_year + 1900;
+     shm->mon    = ttyclock->tm->tm_mon + 1;
+     shm->mday   = ttyclock->tm->tm_mday;
+     shm->wday   = ttyclock->tm->tm_wday;
+     shm->yday   = ttyclock->tm->tm_yday;
+     shm->hour   = ttyclock->tm->tm_hour;
+     shm->min    = ttyclock->tm->tm_min;
+     shm->sec    = ttyclock->tm->tm_sec;
+     shm->isdst  = ttyclock->tm->tm_isdst;
+     shm->gmtoff = ttyclock->tm->tm_gmtoff;
+
+     shm->digit[SlotHour0]   = ttyclock->date.hour[0];
+     shm->digit[SlotHour1]   = ttyclock->date.hour[1];
+     shm->digit[SlotMinute0] = ttyclock->date.minute[0];
+     shm->digit[SlotMinute1] = ttyclock->date.minute[1];
+     shm->digit[SlotSecond0] = ttyclock->date.second[0];
+     shm->digit[SlotSecond1] = ttyclock->date.second[1];
+     snprintf(shm->meridiem, sizeof(shm->meridiem), "%s", ttyclock->meridiem);
+     snprintf(shm->datestr, sizeof(shm->datestr), "%s", ttyclock->date.datestr);
+
+     /* The cells on screen, animation frames included */
+     shm->framew = w;
+     shm->frameh = SHM_FRAMEH;
+     for(x = 0; x < SHM_FRAMEH; ++x)
+     {
+          memset(shm->frame[x], ' ', SHM_FRAMEW);
+          shm->frame[x][w] = '\0';
+          for(s = 0; s < nslot; ++s)
+          {
+               mask = (ttyclock->drawn[s] < 0) ? 0 : ttyclock->shown[s];
+               for(i = 0; i < 3; ++i)
+                    if((mask >> (x * 3 + i)) & 1)
+                         memcpy(&shm->frame[x][col[s] + i * 2], "##", 2);
+          }
+          if(x == 1 || x == 3)
+          {
+               shm->frame[x][15] = shm->frame[x][16] = colon;
+               if(nslot == SlotLast)
+                    shm->frame[x][NORMFRAMEW - 1] = shm->frame[x][NORMFRAMEW] = colon;
+          }
+     }
+
+     __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+
+     return;
+}
+
+/* Load the --alarms file, in full, before the clock shows up */
+void
+init_alarms(void)
+{
+     ttyclock->alarm.wheel.now = time(NULL);
+     ttyclock->alarm.checked = ttyclock->alarm.wheel.now;
+
+     if(!(ttyclock->alarm.load = fopen(ttyclock->alarm.file, "r"))
+        || fstat(fileno(ttyclock->alarm.load), &ttyclock->alarm.st) < 0)
+     {
+          fprintf(stderr, "tty-clock: error: '%s' couldn't be opened: %s.\n",
+                  ttyclock->alarm.file, strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+
+     alarm_load(True);
+
+     return;
+}
+
+/* Parse the alarms file being loaded line by line, for ALARM_SLICE at
+ * most unless all is True. Once it is read to the end the new alarms
+ * replace the old ones and True is returned. */
+Bool
+alarm_load(Bool all)
+{
+     char buf[ALARM_LINELEN];
+     uint64_t start = clock_now();
+     alarm_t a, *grown;
+     size_t len, n;
+     int c, r;
+
+     while(fgets(buf, sizeof(buf), ttyclock->alarm.load))
+     {
+          ++ttyclock->alarm.line;
+          len = strlen(buf);
+
+          /* A line too long for buf isn't an alarm, skip the rest of it */
+          if(len == sizeof(buf) - 1 && buf[len - 1] != '\n')
+          {
+               while((c = getc(ttyclock->alarm.load)) != EOF && c != '\n');
+               r = -1;
+          }
+          else
+               r = alarm_parse(buf, &a);
+
+          /* Only the first load can complain, curses has the terminal after */
+          if(r < 0 && all)
+               fprintf(stderr, "tty-clock: warning: %s:%d: not an alarm, ignored.\n",
+                       ttyclock->alarm.file, ttyclock->alarm.line);
+
+          if(r > 0 && (a.when = alarm_next(&a, ttyclock->alarm.wheel.now)))
+          {
+               if(ttyclock->alarm.nnext == ttyclock->alarm.snext)
+               {
+                    len = (ttyclock->alarm.snext) ? ttyclock->alarm.snext * 2 : 64;
+                    if(!(grown = realloc(ttyclock->alarm.next, len * sizeof(alarm_t))))
+                         continue;
+                    ttyclock->alarm.next = grown;
+                    ttyclock->alarm.snext = len;
+               }
+               ttyclock->alarm.next[ttyclock->alarm.nnext++] = a;
+          }
+
+          if(!all && !(ttyclock->alarm.line % 64) && clock_now() - start > ALARM_SLICE)
+               return False;
+     }
+
+     fclose(ttyclock->alarm.load);
+     ttyclock->alarm.load = NULL;
+
+     free(ttyclock->alarm.set);
+     ttyclock->alarm.set = ttyclock->alarm.next;
+     ttyclock->alarm.count = ttyclock->alarm.nnext;
+     ttyclock->alarm.next = NULL;
+     ttyclock->alarm.nnext = ttyclock->alarm.snext = 0;
+
+     /* The wheel went on while the file was read, and the old alarms
+      * already rang for what it went past */
+     for(n = 0; n < ttyclock->alarm.count; ++n)
+          if(ttyclock->alarm.set[n].when < ttyclock->alarm.wheel.now)
+               ttyclock->alarm.set[n].when = alarm_next(&ttyclock->alarm.set[n],
+                                                        ttyclock->alarm.wheel.now);
+
+     wheel_rebuild(ttyclock->alarm.wheel.now);
+
+     return True;
+}
+
+/* Parse a line of the alarms file into a:
+ *
+ *     <when> HH:MM[:SS] [message]
+ *
+ * <when> is a date, YYYY-MM-DD, for an alarm that goes off once, or a
+ * comma separated list of days (sun, mon, ... sat, daily, weekdays and
+ * weekends) for one that recurs. Returns 1 for an alarm, 0 for a blank
+ * or comment line and -1 for anything else. */
+int
+alarm_parse(char *line, alarm_t *a)
+{
+     const char *wday[7] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+     char *when, *hour, *day, *save = NULL, *p;
+     int i, n = 0;
+
+     memset(a, 0, sizeof(*a));
+
+     if(!(when = strtok_r(line, " \t\r\n", &save)) || *when == '#')
+          return 0;
+     if(!(hour = strtok_r(NULL, " \t\r\n", &save)))
+          return -1;
+
+     if(sscanf(when, "%4d-%2d-%2d%n", &a->year, &a->mon, &a->mday, &n) == 3 && !when[n])
+     {
+          if(a->mon < 1 || a->mon > 12 || a->mday < 1 || a->mday > 31)
+               return -1;
+     }
+     else
+     {
+          for(day = strtok_r(when, ",", &p); day; day = strtok_r(NULL, ",", &p))
+          {
+               if(!strcasecmp(day, "daily"))
+                    a->days |= 0x7f;
+               else if(!strcasecmp(day, "weekdays"))
+                    a->days |= 0x3e;
+               else if(!strcasecmp(day, "weekends"))
+                    a->days |= 0x41;
+               else
+               {
+                    for(i = 0; i < 7 && strcasecmp(day, wday[i]); ++i);
+                    if(i == 7)
+                         return -1;
+                    a->days |= 1 << i;
+               }
+          }
+          if(!a->days)
+               return -1;
+     }
+
+     n = 0;
+     if(sscanf(hour, "%2d:%2d%n:%2d%n", &a->hour, &a->min, &n, &a->sec, &n) < 2 || hour[n]
+        || a->hour < 0 || a->hour > 23 || a->min < 0 || a->min > 59 || a->sec < 0 || a->sec > 59)
+          return -1;
+
+     /* The rest of the line is the message */
+     p = (save) ? save + strspn(save, " \t") : "";
+     for(n = strlen(p); n > 0 && strchr(" \t\r\n", p[n - 1]); p[--n] = '\0');
+     snprintf(a->message, sizeof(a->message), "%s", (*p) ? p : "Alarm");
+     for(i = 0; a->message[i]; ++i)
+          if((unsigned char)a->message[i] < ' ')
+               a->message[i] = ' ';
+
+     return 1;
+}
+
+/* Next time, at or after t, alarm a goes off; 0 if it doesn't anymore.
+ * Its time of day is taken in the time zone of the clock. */
+time_t
+alarm_next(alarm_t *a, time_t t)
+{
+     struct tm now, tm;
+     time_t when;
+     int d;
+
+     if(!a->days)
+     {
+          memset(&tm, 0, sizeof(tm));
+          tm.tm_year  = a->year - 1900;
+          tm.tm_mon   = a->mon - 1;
+          tm.tm_mday  = a->mday;
+          tm.tm_hour  = a->hour;
+          tm.tm_min   = a->min;
+          tm.tm_sec   = a->sec;
+          tm.tm_isdst = -1;
+          when = (ttyclock->option.utc) ? timegm(&tm) : mktime(&tm);
+
+          return (when >= t) ? when : 0;
+     }
+
+     if(ttyclock->option.utc)
+          gmtime_r(&t, &now);
+     else
+          localtime_r(&t, &now);
+
+     /* It recurs on one of the next eight days, today included */
+     for(d = 0; d < 8; ++d)
+     {
+          if(!((a->days >> ((now.tm_wday + d) % 7)) & 1))
+               continue;
+
+          tm = now;
+          tm.tm_mday += d;
+          tm.tm_hour  = a->hour;
+          tm.tm_min   = a->min;
+          tm.tm_sec   = a->sec;
+          tm.tm_isdst = -1;
+          when = (ttyclock->option.utc) ? timegm(&tm) : mktime(&tm);
+
+          if(when >= t && (a->days >> tm.tm_wday) & 1)
+               return when;
+     }
+
+     return 0;
+}
+
+/* Run the alarms up to the time update_hour() just read, and reload their
+ * file when it changed */
+void
+alarm_update(void)
+{
+     struct stat st;
+     time_t lt = ttyclock->lt;
+     size_t n;
+
+     if(!ttyclock->alarm.file)
+          return;
+
+     /* The wall clock was set back: when every alarm goes off next, those
+      * being loaded included, was worked out from a time still to come.
+      * Work it out again from now, one-off alarms that already went off
+      * included. */
+     if(lt + 1 < ttyclock->alarm.wheel.now)
+     {
+          for(n = 0; n < ttyclock->alarm.count; ++n)
+               ttyclock->alarm.set[n].when = alarm_next(&ttyclock->alarm.set[n], lt);
+          for(n = 0; n < ttyclock->alarm.nnext; ++n)
+               ttyclock->alarm.next[n].when = alarm_next(&ttyclock->alarm.next[n], lt);
+          wheel_rebuild(lt);
+     }
+     /* So far forward that running the wheel second by second isn't worth
+      * it: hang the alarms again, those that were skipped go off at once */
+     else if(lt - ttyclock->alarm.wheel.now > WHEEL_SIZE * WHEEL_SIZE)
+          wheel_rebuild(lt);
+
+     ttyclock->alarm.fired = NULL;
+     wheel_run(lt);
+
+     if(ttyclock->alarm.fired)
+          alarm_ring(ttyclock->alarm.fired);
+     else if(ttyclock->alarm.ringing && lt >= ttyclock->alarm.until)
+          alarm_ring(NULL);
+
+     if(ttyclock->alarm.load)
+          alarm_load(False);
+     else if(lt != ttyclock->alarm.checked)
+     {
+          ttyclock->alarm.checked = lt;
+          if(stat(ttyclock->alarm.file, &st) == 0
+             && (st.st_ino != ttyclock->alarm.st.st_ino
+                 || st.st_size != ttyclock->alarm.st.st_size
+                 || st.st_mtime != ttyclock->alarm.st.st_mtime)
+             && (ttyclock->alarm.load = fopen(ttyclock->alarm.file, "r")))
+          {
+               fstat(fileno(ttyclock->alarm.load), &ttyclock->alarm.st);
+               ttyclock->alarm.line = 0;
+               alarm_load(False);
+          }
+     }
+
+     return;
+}
+
+/* Alarm a is due: have it ring and hang it again if it recurs */
+void
+alarm_fire(alarm_t *a)
+{
+     ttyclock->alarm.fired = a->message;
+
+     if((a->when = (a->days) ? alarm_next(a, ttyclock->alarm.wheel.now) : 0))
+          wheel_add(a);
+
+     return;
+}
+
+/* Start ringing with message, or stop with NULL. A ringing alarm turns
+ * the clock to another color and shows its message in the date window,
+ * which flashes (see draw_clock()). */
+void
+alarm_ring(const char *message)
+{
+     /* With -D the date window goes away again */
+     if(!message && !ttyclock->option.date)
+     {
+          wbkgdset(ttyclock->datewin, COLOR_PAIR(0));
+          werase(ttyclock->datewin);
+          wrefresh(ttyclock->datewin);
+     }
+
+     if((ttyclock->alarm.ringing = (message != NULL)))
+     {
+          snprintf(ttyclock->alarm.message, sizeof(ttyclock->alarm.message), "%s", message);
+          ttyclock->alarm.until = ttyclock->lt + ALARM_RING;
+     }
+
+     init_pair(1, ttyclock->bg, clock_color());
+     init_pair(2, clock_color(), ttyclock->bg);
+
+     /* Resize the date window to the message */
+     clock_move(ttyclock->geo.x, ttyclock->geo.y, ttyclock->geo.w, ttyclock->geo.h);
+
+     return;
+}
+
+/* Nanoseconds until the alarms need the clock again: the next second
+ * the wheel has something to do at, the next flash of a ringing alarm,
+ * or right away while their file is reloaded. UINT64_MAX for never. */
+uint64_t
+alarm_deadline(void)
+{
+     struct timespec ts;
+     time_t next;
+
+     if(!ttyclock->alarm.file)
+          return UINT64_MAX;
+     if(ttyclock->alarm.load)
+          return 0;
+
+     next = wheel_next();
+     if(ttyclock->alarm.ringing && (!next || next > ttyclock->lt + 1))
+          next = ttyclock->lt + 1;
+     if(!next)
+          return UINT64_MAX;
+
+     clock_gettime(CLOCK_REALTIME, &ts);
+     if(next <= ts.tv_sec)
+          return 0;
+
+     return (uint64_t)(next - ts.tv_sec) * 1000000000 - ts.tv_nsec;
+}
+
+/* Hang alarm a in the wheel: in level 0, at its second, when it is due
+ * within WHEEL_SIZE seconds, else in the first level with slots coarse
+ * enough, from where it cascades down as its time comes. None of the
+ * wheel operations depend on the number of alarms in it. */
+void
+wheel_add(alarm_t *a)
+{
+     wheel_t *w = &ttyclock->alarm.wheel;
+     time_t span = (time_t)1 << (WHEEL_BITS * WHEEL_LEVELS);
+     time_t when = (a->when < w->now) ? w->now : a->when;
+     int l, i;
+
+     /* Beyond the last level, wait in its furthest slot */
+     if(when - w->now >= span)
+          when = w->now + span - 1;
+
+     for(l = 0; l < WHEEL_LEVELS - 1
+              && when - w->now >= (time_t)1 << (WHEEL_BITS * (l + 1)); ++l);
+
+     i = (when >> (WHEEL_BITS * l)) & (WHEEL_SIZE - 1);
+     a->next = w->slot[l][i];
+     w->slot[l][i] = a;
+     w->used[l] |= (uint64_t)1 << i;
+
+     return;
+}
+
+/* Spread slot i of level l over the levels below */
+void
+wheel_cascade(int l, int i)
+{
+     wheel_t *w = &ttyclock->alarm.wheel;
+     alarm_t *a = w->slot[l][i], *next;
+
+     w->slot[l][i] = NULL;
+     w->used[l] &= ~((uint64_t)1 << i);
+
+     for(; a; a = next)
+     {
+          next = a->next;
+          wheel_add(a);
+     }
+
+     return;
+}
+
+/* Run the wheel up to second t included, firing the alarms due */
+void
+wheel_run(time_t t)
+{
+     wheel_t *w = &ttyclock->alarm.wheel;
+     alarm_t *a, *next;
+     int l, i;
+
+     while(w->now <= t)
+     {
+          /* Each time a level comes round, the next slot of the level
+           * above comes down */
+          for(l = 1; l < WHEEL_LEVELS
+                   && !((w->now >> (WHEEL_BITS * (l - 1))) & (WHEEL_SIZE - 1)); ++l)
+               wheel_cascade(l, (w->now >> (WHEEL_BITS * l)) & (WHEEL_SIZE - 1));
+
+          i = w->now & (WHEEL_SIZE - 1);
+          a = w->slot[0][i];
+          w->slot[0][i] = NULL;
+          w->used[0] &= ~((uint64_t)1 << i);
+          ++w->now;
+
+          for(; a; a = next)
+          {
+               next = a->next;
+               alarm_fire(a);
+          }
+     }
+
+     return;
+}
+
+/* Empty the wheel and hang every alarm again from second t */
+void
+wheel_rebuild(time_t t)
+{
+     wheel_t *w = &ttyclock->alarm.wheel;
+     size_t n;
+
+     memset(w, 0, sizeof(*w));
+     w->now = t;
+
+     for(n = 0; n < ttyclock->alarm.count; ++n)
+          if(ttyclock->alarm.set[n].when)
+               wheel_add(&ttyclock->alarm.set[n]);
+
+     return;
+}
+
+/* Next second the wheel has to run at: the first non-empty slot of level
+ * 0, or the first cascade of a non-empty slot of an upper level, found
+ * from the bitmaps of used slots (WHEEL_SIZE is 64). 0 when it is empty. */
+time_t
+wheel_next(void)
+{
+     wheel_t *w = &ttyclock->alarm.wheel;
+     time_t next = 0, pos, t;
+     uint64_t used;
+     int l, r;
+
+     for(l = 0; l < WHEEL_LEVELS; ++l)
+     {
+          if(!w->used[l])
+               continue;
+
+          /* An upper level cascades its current slot when the levels
+           * below come round: now, or it already has */
+          pos = w->now >> (WHEEL_BITS * l);
+          if(w->now & (((time_t)1 << (WHEEL_BITS * l)) - 1))
+               ++pos;
+          r = pos & (WHEEL_SIZE - 1);
+          used = (w->used[l] >> r) | (w->used[l] << ((WHEEL_SIZE - r) & (WHEEL_SIZE - 1)));
+          t = (pos + __builtin_ctzll(used)) << (WHEEL_BITS * l);
+
+          if(!next || t < next)
+               next = t;
+     }
+
+     return next;
+}
+
+/* Color of the clock, another one while an alarm rings */
+int
+clock_color(void)
+{
+     if(!ttyclock->alarm.ringing)
+          return ttyclock->option.color;
+
+     return (ttyclock->option.color == ALARM_COLOR) ? COLOR_YELLOW : ALARM_COLOR;
+}
+
+/* The date window shows the date, or the message of a ringing alarm */
+Bool
+date_shown(void)
+{
+     return ttyclock->option.date || ttyclock->alarm.ringing;
+}
+
+const char *
+date_text(void)
+{
+     return (ttyclock->alarm.ringing) ? ttyclock->alarm.message : ttyclock->date.datestr;
+}
+
+/* Column of the date window, centered under the clock */
+int
+date_y(void)
+{
+     int y = ttyclock->geo.y + (ttyclock->geo.w / 2) - ((int)strlen(date_text()) / 2) - 1;
+
+     return (y < 0) ? 0 : y;
+}
+
+uint64_t
+clock_now(void)
+{
+     struct timespec ts;
+
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+
+     return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t
+stats_now(void)
+{
+     return (ttyclock->stats.enabled) ? clock_now() : 0;
+}
+
+/* Record the time elapsed since start in phase p, return the current time */
+uint64_t
+stats_lap(Phase p, uint64_t start)
+{
+     uint64_t now = stats_now();
+
+     if(ttyclock->stats.enabled)
+          stats_record(p, now - start);
+
+     return now;
+}
+
+/* Called at the top of each frame, record the frame interval and jitter */
+uint64_t
+stats_frame(void)
+{
+     uint64_t now = stats_now();
+     uint64_t expect, interval;
+
+     if(!ttyclock->stats.enabled)
+          return now;
+
+     if(ttyclock->stats.frames++)
+     {
+          /* Against the sleep of the last frame, which animations and
+           * alarms shorten, not -d and -a. A sleep woken on purpose is
+           * no lateness of ours. */
+          expect = ttyclock->stats.timeout;
+          interval = now - ttyclock->stats.last_frame;
+
+          stats_record(PhaseFrame, interval);
+          if(ttyclock->stats.timedout)
+               stats_record(PhaseJitter, (interval > expect) ? interval - expect : expect - interval);
+          else
+               ++ttyclock->stats.early;
+     }
+     ttyclock->stats.last_frame = now;
+     ttyclock->stats.slept = 0;
+     ttyclock->stats.timeout = 0;
+     ttyclock->stats.timedout = False;
+
+     return now;
+}
+
+void
+stats_record(Phase p, uint64_t ns)
+{
+     histogram_t *h = &ttyclock->stats.phase[p];
+     int e, i = ns;
+
+     /* Linear below STATS_SUBBUCKETS, log-linear above */
+     if(ns >= STATS_SUBBUCKETS)
+     {
+          for(e = STATS_SUBBITS; ns >> (e + 1); ++e);
+          i = ((e - STATS_SUBBITS + 1) << STATS_SUBBITS)
+               + ((ns >> (e - STATS_SUBBITS)) & (STATS_SUBBUCKETS - 1));
+     }
+
+     ++h->bucket[i];
+     ++h->count;
+     h->sum += ns;
+     if(ns > h->max)
+          h->max = ns;
+
+     return;
+}
+
+/* Upper bound of the bucket holding the q quantile */
+uint64_t
+stats_percentile(histogram_t *h, double q)
+{
+     uint64_t rank, seen = 0, v = 0;
+     int i, e;
+
+     if(!h->count)
+          return 0;
+
+     rank = q * h->count + 0.5;
+     if(rank < 1)
+          rank = 1;
+
+     for(i = 0; i < STATS_BUCKETS; ++i)
+          if((seen += h->bucket[i]) >= rank)
+               break;
+
+     if(i < STATS_SUBBUCKETS)
+          v = i;
+     else
+     {
+          e = (i >> STATS_SUBBITS) + STATS_SUBBITS - 1;
+          v = ((uint64_t)(STATS_SUBBUCKETS + (i & (STATS_SUBBUCKETS - 1))) << (e - STATS_SUBBITS))
+               + ((uint64_t)1 << (e - STATS_SUBBITS)) - 1;
+     }
+
+     return (v > h->max) ? h->max : v;
+}
+
+void
+stats_dump(void)
+{
+     const char *name[PhaseLast] =
+          { "update", "draw", "refresh", "input", "sleep", "frame_interval", "jitter" };
+     FILE *f = stderr;
+     histogram_t *h;
+     uint64_t i;
+     int p;
+
+     if(ttyclock->stats.file && !(f = fopen(ttyclock->stats.file, "w")))
+     {
+          fprintf(stderr, "tty-clock: error: '%s' couldn't be opened: %s.\n",
+                  ttyclock->stats.file, strerror(errno));
+          return;
+     }
+
+     fprintf(f, "{\n  \"frames\": %llu,\n  \"early_wakes\": %llu,\n"
+             "  \"delay_ns\": %llu,\n  \"phases\": {\n",
+             (unsigned long long)ttyclock->stats.frames,
+             (unsigned long long)ttyclock->stats.early,
+             (unsigned long long)ttyclock->option.delay * 1000000000 + ttyclock->option.nsdelay);
+
+     for(p = 0; p < PhaseLast; ++p)
+     {
+          h = &ttyclock->stats.phase[p];
+          fprintf(f, "    \"%s\": { \"count\": %llu, \"mean_ns\": %llu, "
+                  "\"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu }%s\n",
+                  name[p],
+                  (unsigned long long)h->count,
+                  (unsigned long long)(h->count ? h->sum / h->count : 0),
+                  (unsigned long long)stats_percentile(h, 0.50),
+                  (unsigned long long)stats_percentile(h, 0.99),
+                  (unsigned long long)h->max,
+                  (p < PhaseLast - 1) ? "," : "");
+     }
+
+     fprintf(f, "  },\n");
+
+     if(ttyclock->anim.style != AnimNone)
+          fprintf(f, "  \"animation\": { \"frames\": %llu, \"drops\": %llu, \"stride\": %d },\n",
+                  (unsigned long long)ttyclock->anim.frames,
+                  (unsigned long long)ttyclock->anim.drops,
+                  ttyclock->anim.stride);
+
+     fprintf(f, "  \"clock_steps\": { \"count\": %llu, \"last_ns\": [",
+             (unsigned long long)ttyclock->step.count);
+
+     i = (ttyclock->step.count > CLOCKSTEP_LOG) ? ttyclock->step.count - CLOCKSTEP_LOG : 0;
+     for(; i < ttyclock->step.count; ++i)
+          fprintf(f, " %lld%s", (long long)ttyclock->step.last[i % CLOCKSTEP_LOG],
+                  (i < ttyclock->step.count - 1) ? "," : " ");
+
+     fprintf(f, "] }\n}\n");
+
+     if(f != stderr)
+          fclose(f);
+     else
+          fflush(f);
+
+     return;
+}
+
+int
+main(int argc, char **argv)
+{
+     int c;
+     uint64_t t, start;
+     struct option long_options[] =
+     {
+          { "stats",  optional_argument, NULL, OPT_STATS },
+          { "stdout", optional_argument, NULL, OPT_STDOUT },
+          { "plain",  no_argument,       NULL, OPT_PLAIN },
+          { "animate", required_argument, NULL, OPT_ANIM },
+          { "fps",    required_argument, NULL, OPT_FPS },
+          { "shm",    optional_argument, NULL, OPT_SHM },
+          { "alarms", required_argument, NULL, OPT_ALARMS },
+          { NULL,    0,                 NULL, 0 }
+     };
+
+     /* Alloc ttyclock */
+     ttyclock = malloc(sizeof(ttyclock_t));
+     assert(ttyclock != NULL);
+     memset(ttyclock, 0, sizeof(ttyclock_t));
+
+     ttyclock->option.date = True;
+
+     /* Date format */
+     ttyclock->option.format = malloc(sizeof(char) * 100);
+     /* Default date format */
+     strncpy(ttyclock->option.format, "%F", 100);
+     /* Default color */
+     ttyclock->option.color = COLOR_GREEN; /* COLOR_GREEN = 2 */
+     /* Default delay */
+     ttyclock->option.delay = 1; /* 1FPS */
+     ttyclock->option.nsdelay = 0; /* -0FPS */
+     ttyclock->option.blink = False;
+     ttyclock->step.fd = -1;
+     ttyclock->anim.fps = 20;
+     ttyclock->anim.stride = 1;
+
+     atexit(cleanup);
+
+     while ((c = getopt_long(argc, argv, "iuvsScbtrhBxnDC:f:d:T:a:", long_options, NULL)) != -1)
+     {
+          switch(c)
+          {
+          case 'h':
+          default:
+               printf("usage : tty-clock [-iuvsScbtrahDBxn] [-C [0-7]] [-f format] [-d delay] [-a nsdelay] [-T tty] \n"
+                      "    -s            Show seconds                                   \n"
+                      "    -S            Screensaver mode                               \n"
+                      "    -x            Show box                                       \n"
+                      "    -c            Set the clock at the center of the terminal    \n"
+                      "    -C [0-7]      Set the clock color                            \n"
+                      "    -b            Use bold colors                                \n"
+                      "    -t            Set the hour in 12h format                     \n"
+                      "    -u            Use UTC time                                   \n"
+              "    -T tty        Display the clock on the specified terminal    \n"
+                      "    -r            Do rebound the clock                           \n"
+                      "    -f format     Set the date format                            \n"
+              "    -n            Don't quit on keypress                         \n"
+                      "    -v            Show tty-clock version                         \n"
+                      "    -i            Show some info about tty-clock                 \n"
+                      "    -h            Show this page                                 \n"
+                      "    -D            Hide date                                      \n"
+                      "    -B            Enable blinking colon                          \n"
+                      "    -d delay      Set the delay between two redraws of the clock. Default 1s. \n"
+                      "    -a nsdelay    Additional delay between two redraws in nanoseconds. Default 0ns.\n"
+                      "    --stats[=file] Dump main loop timings as JSON at exit and on SIGUSR1.\n"
+                      "    --stdout[=ms] Print the clock to stdout once, or every ms milliseconds.\n"
+                      "    --plain       Print --stdout frames as plain text instead of ANSI.\n"
+                      "    --animate style Animate digit changes: slide, roll or fade.\n"
+                      "    --fps fps     Frame rate of the animations. Default 20.\n"
+                      "    --shm[=name]  Publish the time and the clock in shared memory.\n"
+                      "    --alarms file Ring the alarms of file, 'a' to dismiss one.\n");
+               exit(EXIT_SUCCESS);
+               break;
+          case 'i':
+               puts("TTY-Clock 2 © by Martin Duquesnoy (xorg62@gmail.com), Grey (grey@greytheory.net)");
+               exit(EXIT_SUCCESS);
+               break;
+          case 'u':
+               ttyclock->option.utc = True;
+               break;
+          case 'v':
+               puts("TTY-Clock 2 © devel version");
+               exit(EXIT_SUCCESS);
+               break;
+          case 's':
+               ttyclock->option.second = True;
+               break;
+          case 'S':
+               ttyclock->option.screensaver = True;
+               break;
+          case 'c':
+               ttyclock->option.center = True;
+               break;
+          case 'b':
+               ttyclock->option.bold = True;
+               break;
+          case 'C':
+               if(atoi(optarg) >= 0 && atoi(optarg) < 8)
+                    ttyclock->option.color = atoi(optarg);
                break;
           case 't':
                ttyclock->option.twelve = True;
@@ -663,21 +2113,96 @@ main(int argc, char **argv)
       case 'n':
            ttyclock->option.noquit = True;
            break;
+          case OPT_STATS:
+               ttyclock->stats.enabled = True;
+               if(optarg)
+                    ttyclock->stats.file = strdup(optarg);
+               break;
+          case OPT_STDOUT:
+               ttyclock->option.stream = True;
+               if(optarg && atol(optarg) > 0)
+                    ttyclock->option.interval = atol(optarg);
+               break;
+          case OPT_PLAIN:
+               ttyclock->option.plain = True;
+               break;
+          case OPT_ANIM:
+               if(!strcmp(optarg, "slide"))
+                    ttyclock->anim.style = AnimSlide;
+               else if(!strcmp(optarg, "roll"))
+                    ttyclock->anim.style = AnimRoll;
+               else if(!strcmp(optarg, "fade"))
+                    ttyclock->anim.style = AnimFade;
+               break;
+          case OPT_FPS:
+               if(atoi(optarg) > 0 && atoi(optarg) <= 100)
+                    ttyclock->anim.fps = atoi(optarg);
+               break;
+          case OPT_SHM:
+               free(ttyclock->shm.name);
+               ttyclock->shm.name = (optarg) ? strdup(optarg) : NULL;
+               ttyclock->shm.enabled = True;
+               break;
+          case OPT_ALARMS:
+               free(ttyclock->alarm.file);
+               ttyclock->alarm.file = strdup(optarg);
+               break;
           }
      }
 
+     if(ttyclock->option.stream)
+     {
+          stream_clock();
+          return 0;
+     }
+
+     if(ttyclock->shm.enabled)
+          init_shm();
+
+     if(ttyclock->alarm.file)
+          init_alarms();
+
+     init_transitions();
      init();
+     clock_watch();
      attron(A_BLINK);
      while(ttyclock->running)
      {
-          clock_rebound();
+          t = stats_frame();
           update_hour();
+          alarm_update();
+          t = stats_lap(PhaseUpdate, t);
+          start = clock_now();
+          clock_rebound();
           draw_clock();
+          publish_shm();
+          t = stats_lap(PhaseDraw, t);
+          doupdate();
+          t = stats_lap(PhaseRefresh, t);
+          anim_account(start);
           key_event();
+          /* Leave out the time key_event() spent in clock_wait() */
+          stats_lap(PhaseInput, t + ttyclock->stats.slept);
+
+          if(ttyclock->stats.dump)
+          {
+               ttyclock->stats.dump = False;
+               stats_dump();
+
+               /* The JSON went over the clock face, paint it all again */
+               if(!ttyclock->stats.file)
+               {
+                    clearok(curscr, True);
+                    clock_invalidate();
+               }
+          }
      }
 
      endwin();
 
+     if(ttyclock->stats.enabled)
+          stats_dump();
+
      return 0;
 }
 
@@ -34,17 +34,32 @@
 #ifndef TTYCLOCK_H_INCLUDED
 #define TTYCLOCK_H_INCLUDED
 
+#ifdef __linux__
+#define _GNU_SOURCE /* ppoll() */
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <time.h>
 #include <signal.h>
 #include <ncurses.h>
 #include <unistd.h>
 #include <getopt.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "ttyclock-shm.h"
 
 /* Macro */
 #define NORMFRAMEW 35
@@ -53,17 +68,166 @@
 #define AMSIGN     " [AM]"
 #define PMSIGN     " [PM]"
 
+/* Long only options */
+#define OPT_STATS  0x100
+#define OPT_STDOUT 0x101
+#define OPT_PLAIN  0x102
+#define OPT_ANIM   0x103
+#define OPT_FPS    0x104
+#define OPT_SHM    0x105
+#define OPT_ALARMS 0x106
+
+/* Size of the buffer a frame is rendered into with --stdout */
+#define STDOUTBUFSIZ 8192
+
+/* Stats histograms: 8 linear sub-buckets per power of two nanoseconds */
+#define STATS_SUBBITS    3
+#define STATS_SUBBUCKETS (1 << STATS_SUBBITS)
+#define STATS_BUCKETS    ((64 - STATS_SUBBITS + 1) << STATS_SUBBITS)
+
+/* Wall clock steps: how many are kept for --stats, and the smallest
+ * jump of CLOCK_REALTIME against CLOCK_MONOTONIC counted as one when
+ * the kernel did not tell us about it */
+#define CLOCKSTEP_LOG 16
+#define CLOCKSTEP_MIN 100000000LL
+
+/* Digit animations: most intermediate frames of a transition, budget of
+ * one frame in estimated bytes (ANIM_CELLBYTES per cell flipped), overruns
+ * in a row before dropping frames and frames on budget before adding them
+ * back. The time budget is half the frame period. */
+#define ANIM_FRAMES     4
+#define ANIM_CELLBYTES  12
+#define ANIM_BYTEBUDGET 1024
+#define ANIM_OVERRUNS   2
+#define ANIM_RECOVER    60
+
+/* Alarms: longest message and line of the alarms file, seconds an alarm
+ * rings unless dismissed, and time spent parsing the file per frame when
+ * it is reloaded */
+#define ALARM_MSGLEN  80
+#define ALARM_LINELEN 512
+#define ALARM_RING    60
+#define ALARM_SLICE   2000000
+#define ALARM_COLOR   COLOR_RED
+
+/* Alarm timer wheel: WHEEL_LEVELS levels of WHEEL_SIZE slots, a slot of
+ * level l spanning WHEEL_SIZE^l seconds */
+#define WHEEL_BITS    6
+#define WHEEL_SIZE    (1 << WHEEL_BITS)
+#define WHEEL_LEVELS  5
+
 typedef enum { False, True } Bool;
 
+/* Timed phases of the main loop (see --stats) */
+typedef enum
+{
+     PhaseUpdate,   /* update_hour() */
+     PhaseDraw,     /* clock_rebound() and draw_clock() */
+     PhaseRefresh,  /* doupdate() */
+     PhaseInput,    /* key_event() minus its sleep */
+     PhaseSleep,    /* clock_wait() */
+     PhaseFrame,    /* interval between two frames */
+     PhaseJitter,   /* distance of that interval from a full sleep asked for */
+     PhaseLast
+} Phase;
+
+/* Digit slots of the clock face, see draw_clock() */
+typedef enum
+{
+     SlotHour0, SlotHour1,
+     SlotMinute0, SlotMinute1,
+     SlotSecond0, SlotSecond1,
+     SlotLast
+} Slot;
+
+typedef enum { AnimNone, AnimSlide, AnimRoll, AnimFade, AnimLast } Anim;
+
+typedef struct
+{
+     uint64_t count, sum, max;
+     uint32_t bucket[STATS_BUCKETS];
+} histogram_t;
+
+/* An entry of the alarms file */
+typedef struct alarm_s
+{
+     struct alarm_s *next;  /* in its wheel slot */
+     time_t when;           /* next time it goes off, 0 when it is over */
+     int days;              /* week days it recurs on, bit 0 for sunday */
+     int year, mon, mday;   /* date it goes off once, when days is 0 */
+     int hour, min, sec;
+     char message[ALARM_MSGLEN];
+} alarm_t;
+
+/* Hierarchical timer wheel of alarms, see wheel_add() */
+typedef struct
+{
+     time_t now;                       /* next second to run */
+     uint64_t used[WHEEL_LEVELS];      /* slots that aren't empty */
+     alarm_t *slot[WHEEL_LEVELS][WHEEL_SIZE];
+} wheel_t;
+
 /* Global ttyclock struct */
 typedef struct
 {
      /* while() boolean */
      Bool running;
 
+     /* Main loop instrumentation */
+     struct
+     {
+          Bool enabled;
+          char *file;
+          volatile sig_atomic_t dump;
+          uint64_t frames;
+          uint64_t last_frame;
+          uint64_t slept;
+          uint64_t timeout;   /* sleep clock_wait() was asked for */
+          Bool timedout;      /* and it ran to the end */
+          uint64_t early;     /* sleeps cut short by input, signals or steps */
+          histogram_t phase[PhaseLast];
+     } stats;
+
+     /* Wall clock step detection */
+     struct
+     {
+          int fd;        /* timerfd cancelled when CLOCK_REALTIME is set */
+          int64_t offset;
+          uint64_t count;
+          int64_t last[CLOCKSTEP_LOG];
+     } step;
+
+     /* Shared memory export */
+     struct
+     {
+          Bool enabled;
+          char *name;
+          ttyclock_shm_t *map;
+     } shm;
+
+     /* Alarms and reminders */
+     struct
+     {
+          char *file;
+          struct stat st;      /* of the file loaded, or being loaded */
+          time_t checked;      /* last time the file was looked at */
+          FILE *load;          /* reload in progress */
+          int line;
+          alarm_t *set;        /* alarms in the wheel */
+          size_t count;
+          alarm_t *next;       /* alarms being loaded */
+          size_t nnext, snext;
+          wheel_t wheel;
+          Bool ringing;
+          time_t until;
+          char message[ALARM_MSGLEN];
+          const char *fired;   /* message of the last alarm run */
+     } alarm;
+
      /* terminal variables */
      SCREEN *ttyscr;
      char *tty;
+     int infd;
      int bg;
 
      /* Running option */
@@ -84,6 +248,9 @@ typedef struct
           long delay;
           Bool blink;
           long nsdelay;
+          Bool stream;
+          long interval;
+          Bool plain;
      } option;
 
      /* Clock geometry */
@@ -92,6 +259,7 @@ typedef struct
           int x, y, w, h;
           /* For rebound use (see clock_rebound())*/
           int a, b;
+          uint64_t next; /* clock_now() of the next step */
      } geo;
 
      /* Date content ([2] = number by number) */
@@ -103,9 +271,29 @@ typedef struct
           char datestr[256];
      } date;
 
+     /* Digit on screen in each slot, -1 when it has to be fully drawn,
+      * and the cells actually lit, which differ during an animation */
+     int drawn[SlotLast];
+     uint16_t shown[SlotLast];
+
+     /* Digit transition animation */
+     struct
+     {
+          Anim style;
+          int fps;
+          int stride;     /* draw every frame (1), every other (2), none (0) */
+          int frame;      /* frame of this draw_clock(), 0 for the digits */
+          Bool pending;   /* a shown digit changes at the next second */
+          unsigned int next[SlotLast];
+          unsigned int cells;
+          int overrun, ontime;
+          uint64_t frames, drops;
+     } anim;
+
      /* time.h utils */
      struct tm *tm;
      time_t lt;
+     long nsec;
 
      /* Clock member */
      char *meridiem;
@@ -119,16 +307,69 @@ void init(void);
 void signal_handler(int signal);
 void update_hour(void);
 void draw_number(int n, int x, int y);
+void draw_digit(Slot s, int n, int x, int y);
+void draw_frame(Slot s, uint16_t mask, int x, int y);
+void draw_cells(uint16_t flip, uint16_t mask, int x, int y);
+int twelve_hour(int hour);
+void next_digits(unsigned int *digit);
+int anim_length(void);
+void anim_update(void);
+uint64_t anim_deadline(void);
+void anim_account(uint64_t start);
+void clock_timeout(struct timespec *length);
+void init_shm(void);
+Bool shm_reclaim(const char *name);
+void publish_shm(void);
+void init_alarms(void);
+Bool alarm_load(Bool all);
+int alarm_parse(char *line, alarm_t *a);
+time_t alarm_next(alarm_t *a, time_t t);
+void alarm_update(void);
+void alarm_fire(alarm_t *a);
+void alarm_ring(const char *message);
+uint64_t alarm_deadline(void);
+void wheel_add(alarm_t *a);
+void wheel_cascade(int l, int i);
+void wheel_run(time_t t);
+void wheel_rebuild(time_t t);
+time_t wheel_next(void);
+int clock_color(void);
+Bool date_shown(void);
+const char *date_text(void);
+int date_y(void);
+uint64_t clock_now(void);
+void init_transitions(void);
+void clock_invalidate(void);
 void draw_clock(void);
 void clock_move(int x, int y, int w, int h);
 void set_second(void);
 void set_center(Bool b);
 void set_box(Bool b);
 void key_event(void);
+size_t render_frame(char *buf, size_t size, Bool first);
+void stream_clock(void);
+void clock_wait(struct timespec *length);
+void clock_watch(void);
+int64_t clock_offset(void);
+Bool clock_step(Bool notified);
+uint64_t stats_now(void);
+uint64_t stats_lap(Phase p, uint64_t start);
+uint64_t stats_frame(void);
+void stats_record(Phase p, uint64_t ns);
+uint64_t stats_percentile(histogram_t *h, double q);
+void stats_dump(void);
 
 /* Global variable */
 ttyclock_t *ttyclock;
 
+/* Cells of number[] lit in each digit, bit i for cell i
+ * (see init_transitions()) */
+uint16_t digit_mask[10];
+
+/* Intermediate cells of every digit transition in each style */
+uint16_t anim_frame[AnimLast][10][10][ANIM_FRAMES];
+const int anim_frames[AnimLast] = { 0, 2, 4, 4 };
+
 /* Number matrix */
 const Bool number[][15] =
 {